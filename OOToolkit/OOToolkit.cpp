@@ -10,6 +10,7 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb/stb_image.h>
 
+#ifndef OOTOOLKIT_HEADLESS
 // OggVorbis
 #include "oggvorbis/ogg.h"
 #include "oggvorbis/codec.h"
@@ -23,13 +24,85 @@
 // DrWav
 #define DR_WAV_IMPLEMENTATION
 #include "dr_wav.h"
+#endif
 
 #include <sys/socket.h>
 #include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#ifdef OOTOOLKIT_HEADLESS
+#include <sys/mman.h>
+#endif
+
+// SSE2 is the baseline for x86_64, so it's always there.
+#include <emmintrin.h>
 
 
 #define OOAUDIOINST (UINT16_MAX)
 
+// default memory budget of a glyph atlas (one per font).
+#define GLYPH_CACHE_BUDGET (2 * 1024 * 1024)
+
+// glyph atlases are roughly this wide, in pixels.
+#define GLYPH_ATLAS_WIDTH (1024)
+
+// frame buffers remember at most this many dirty rectangles, more get merged.
+#define DIRTY_RECT_MAX (64)
+
+// fills bigger than this (in pixels) are done with non-temporal stores, they won't fit into the cache anyway.
+#define FILL_STREAM_THRESHOLD (256 * 1024)
+
+// 16-bit blends are done in A8R8G8B8, this many pixels at a time.
+#define BLEND_CHUNK (256)
+
+// sprite pages are this many pixels wide and high.
+#define SPRITE_PAGE_SIZE (1024)
+
+// sprites bigger than this in either direction keep their own buffer.
+#define SPRITE_PAGE_MAX (256)
+
+// frame stats are kept for this many of the last frames.
+#define FRAME_STATS_WINDOW (256)
+
+// the simulated flip queue remembers when this many of the last flips happened.
+#define FLIP_TIME_HISTORY (16)
+
+// the display refreshes at 60 Hz, that's the flip rate Init sets.
+#define VBLANK_PERIOD_US (16667)
+
+// tiled rendering splits the frame buffer into squares this big, in pixels.
+#define RENDER_TILE_SIZE (128)
+
+// baked sprite files, see OOSpriteFileHeader.
+#define SPRITE_FILE_VERSION (3)
+#define SPRITE_FILE_EXT ".oos"
+#define SPRITE_FILE_PIXELS_MAX (400000000) // same cap as QOI, a header asking for more is corrupt.
+
+// QOI chunk tags, the 2-bit ones live in the top two bits.
+#define QOI_OP_INDEX (0x00)
+#define QOI_OP_DIFF (0x40)
+#define QOI_OP_LUMA (0x80)
+#define QOI_OP_RUN (0xC0)
+#define QOI_OP_RGB (0xFE)
+#define QOI_OP_RGBA (0xFF)
+#define QOI_HEADER_SIZE (14)
+#define QOI_PADDING_SIZE (8)
+#define QOI_PIXELS_MAX (400000000)
+
+// the video memory region and the frame buffers in it are aligned to this.
+#define VIDEO_MEM_ALIGN (0x200000)
+
+// smallest block (and alignment) the video memory allocator hands out, also the second level size class count.
+#define VIDEO_ALLOC_GRANULE (64)
+#define VIDEO_ALLOC_SL_BITS (4)
+
+// threads decoding InitPNGAsync images, started with the first one.
+#define PNG_LOAD_THREADS (3)
+
 #pragma region // OOTcpClient
 
 OOTcpClient::OOTcpClient() {
@@ -254,6 +327,77 @@ void OOerrorOut(const char* file, const char* func, int line, const char* msg) {
 
 #pragma endregion
 
+#pragma region // OOAssetCache
+
+// 64-bit FNV-1a
+static uint64_t hashBytes(const void *data, size_t size) {
+	const unsigned char *bytes = reinterpret_cast<const unsigned char *>(data);
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < size; i++) {
+		hash = (hash ^ bytes[i]) * 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+int OOAssetCache::Acquire(const std::string& key) {
+	auto found = this->handles.find(key);
+	if (found == this->handles.end()) {
+		return -1;
+	}
+
+	this->entries[found->second].refs++;
+	return found->second;
+}
+
+int OOAssetCache::Insert(const std::string& key, int handle) {
+	if (handle < 0) {
+		return handle;
+	}
+
+	this->handles[key] = handle;
+	this->entries[handle] = { key, 1 };
+	return handle;
+}
+
+bool OOAssetCache::Release(int handle) {
+	auto found = this->entries.find(handle);
+
+	// not loaded through the cache, nobody else has it
+	if (found == this->entries.end()) {
+		return true;
+	}
+
+	if (--found->second.refs > 0) {
+		return false;
+	}
+
+	this->handles.erase(found->second.key);
+	this->entries.erase(found);
+	return true;
+}
+
+std::string OOAssetCache::FileKey(const std::string& path) {
+	return "file:" + path;
+}
+
+std::string OOAssetCache::ContentKey(const void *data, size_t size) {
+	// The whole 64-bit hash and the size, a collision is unlikely enough to live with.
+	// Keeping the bytes around to compare would cost as much memory as sharing saves
+	std::stringstream key;
+	key << "data:" << std::hex << hashBytes(data, size) << ":" << std::dec << size;
+	return key.str();
+}
+
+std::string OOAssetCache::BufferKey(const void *data, size_t size) {
+	std::stringstream key;
+	key << "buffer:" << data << ":" << size;
+	return key.str();
+}
+
+#pragma endregion
+
+#ifndef OOTOOLKIT_HEADLESS
 #pragma region // OOController
 
 OOController::OOController() {
@@ -372,337 +516,3632 @@ OrbisPadVibeParam OOController::GetVibration() {
 }
 
 #pragma endregion
+#endif
 
-#pragma region // OOPNG
+#pragma region // Raster helpers
 
-OOPNG::OOPNG(size_t bufsize, unsigned char* bufpng) {
-	this->img = reinterpret_cast<uint32_t *>(stbi_load_from_memory(bufpng, bufsize, &this->width, &this->height, &this->channels, STBI_rgb_alpha));
+// Render target pixel formats, as tags to compile the raster loops for.
+// Colors and sprites are always A8R8G8B8, other formats convert on the way in.
+struct OOFormatA8R8G8B8 {
+	typedef uint32_t Pixel;
+};
 
-	if (this->img == nullptr) {
-		OOCRASHMSG("Failed to load PNG image from memory.");
-		return;
+struct OOFormatR5G6B5 {
+	typedef uint16_t Pixel;
+};
+
+static inline size_t pixelSize(OOPixelFormat format) {
+	return format == PIXEL_R5G6B5 ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+// Encode a color into the frame buffer format (0x80RRGGBB).
+static inline uint32_t encodeColor(Color color) {
+	return 0x80000000 + (color.r << 16) + (color.g << 8) + color.b;
+}
+
+static inline uint32_t encodePixel(OOFormatA8R8G8B8, Color color) {
+	return encodeColor(color);
+}
+
+static inline uint16_t encodePixel(OOFormatR5G6B5, Color color) {
+	return static_cast<uint16_t>(((color.r >> 3) << 11) | ((color.g >> 2) << 5) | (color.b >> 3));
+}
+
+static inline __m128i splat(uint32_t value) {
+	return _mm_set1_epi32(static_cast<int>(value));
+}
+
+static inline __m128i splat(uint16_t value) {
+	return _mm_set1_epi16(static_cast<short>(value));
+}
+
+// Fill `count` pixels at `dst` with an already encoded color.
+// Stores 64 bytes per iteration, `stream` makes them non-temporal so a big fill won't thrash the cache.
+template <class Pixel> static void fillSpan(Pixel *dst, Pixel encodedColor, size_t count, bool stream) {
+	const size_t lanes = 16 / sizeof(Pixel);
+
+	// Scalar head until dst is 16-byte aligned
+	while (count > 0 && (reinterpret_cast<uintptr_t>(dst) & 15) != 0) {
+		*dst++ = encodedColor;
+		count--;
+	}
+
+	__m128i wide = splat(encodedColor);
+	__m128i *wdst = reinterpret_cast<__m128i *>(dst);
+
+	if (stream) {
+		for (; count >= lanes * 4; count -= lanes * 4, wdst += 4) {
+			_mm_stream_si128(wdst + 0, wide);
+			_mm_stream_si128(wdst + 1, wide);
+			_mm_stream_si128(wdst + 2, wide);
+			_mm_stream_si128(wdst + 3, wide);
+		}
+
+		// make the non-temporal stores visible before anyone reads the buffer
+		_mm_sfence();
+	}
+	else {
+		for (; count >= lanes * 4; count -= lanes * 4, wdst += 4) {
+			_mm_store_si128(wdst + 0, wide);
+			_mm_store_si128(wdst + 1, wide);
+			_mm_store_si128(wdst + 2, wide);
+			_mm_store_si128(wdst + 3, wide);
+		}
+	}
+
+	for (; count >= lanes; count -= lanes, wdst++) {
+		_mm_store_si128(wdst, wide);
+	}
+
+	// Scalar tail
+	dst = reinterpret_cast<Pixel *>(wdst);
+	while (count > 0) {
+		*dst++ = encodedColor;
+		count--;
 	}
 }
 
-OOPNG::OOPNG(const char *imagePath) {
-	this->img = reinterpret_cast<uint32_t *>(stbi_load(imagePath, &this->width, &this->height, &this->channels, STBI_rgb_alpha));
+// Copy `count` pixels from `src` to `dst` with non-temporal stores, for write-combined destinations.
+// Nothing is read back from `dst` and it doesn't end up in the cache.
+static void streamSpan(uint32_t *dst, const uint32_t *src, size_t count) {
+	// Scalar head until dst is 16-byte aligned
+	while (count > 0 && (reinterpret_cast<uintptr_t>(dst) & 15) != 0) {
+		*dst++ = *src++;
+		count--;
+	}
 
-	if (this->img == nullptr) {
-		OOCRASHMSG("Failed to load PNG image.");
-		return;
+	__m128i *wdst = reinterpret_cast<__m128i *>(dst);
+	const __m128i *wsrc = reinterpret_cast<const __m128i *>(src);
+
+	for (; count >= 16; count -= 16, wdst += 4, wsrc += 4) {
+		__m128i a = _mm_loadu_si128(wsrc + 0);
+		__m128i b = _mm_loadu_si128(wsrc + 1);
+		__m128i c = _mm_loadu_si128(wsrc + 2);
+		__m128i d = _mm_loadu_si128(wsrc + 3);
+		_mm_stream_si128(wdst + 0, a);
+		_mm_stream_si128(wdst + 1, b);
+		_mm_stream_si128(wdst + 2, c);
+		_mm_stream_si128(wdst + 3, d);
+	}
+
+	for (; count >= 4; count -= 4, wdst++, wsrc++) {
+		_mm_stream_si128(wdst, _mm_loadu_si128(wsrc));
+	}
+
+	// Scalar tail
+	dst = reinterpret_cast<uint32_t *>(wdst);
+	src = reinterpret_cast<const uint32_t *>(wsrc);
+	while (count > 0) {
+		*dst++ = *src++;
+		count--;
 	}
+
+	// make the non-temporal stores visible before the display reads the buffer
+	_mm_sfence();
 }
 
-OOPNG::~OOPNG() {
-	if (this->img != nullptr) {
-		DEBUGLOG << "[DEBUG] [PNG] Freeing image...";
-		stbi_image_free(this->img);
-		this->img = nullptr;
+// Convert `count` A8R8G8B8 pixels to R5G6B5, truncating each channel.
+static void copySpan(uint16_t *dst, const uint32_t *src, size_t count) {
+	__m128i maskR = _mm_set1_epi32(0xF800);
+	__m128i maskG = _mm_set1_epi32(0x07E0);
+	__m128i maskB = _mm_set1_epi32(0x001F);
+	__m128i bias32 = _mm_set1_epi32(0x8000);
+	__m128i bias16 = _mm_set1_epi16(static_cast<short>(0x8000));
 
-		// also reset other properties just in case.
-		this->width = 0;
-		this->height = 0;
-		this->channels = 0;
+	for (; count >= 8; count -= 8, dst += 8, src += 8) {
+		__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+		__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 4));
+
+		a = _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_srli_epi32(a, 8), maskR), _mm_and_si128(_mm_srli_epi32(a, 5), maskG)), _mm_and_si128(_mm_srli_epi32(a, 3), maskB));
+		b = _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_srli_epi32(b, 8), maskR), _mm_and_si128(_mm_srli_epi32(b, 5), maskG)), _mm_and_si128(_mm_srli_epi32(b, 3), maskB));
+
+		// SSE2 only packs to signed 16-bit, so shift into its range and back
+		__m128i packed = _mm_packs_epi32(_mm_sub_epi32(a, bias32), _mm_sub_epi32(b, bias32));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_add_epi16(packed, bias16));
+	}
+
+	// Scalar tail, same math
+	for (; count > 0; count--, dst++, src++) {
+		*dst = static_cast<uint16_t>(((*src >> 8) & 0xF800) | ((*src >> 5) & 0x07E0) | ((*src >> 3) & 0x001F));
 	}
 }
 
-void OOPNG::GetInfo(SpriteDim& sdim) {
-	sdim.w = this->width;
-	sdim.h = this->height;
-	sdim.c = this->channels;
+static void copySpan(uint32_t *dst, const uint32_t *src, size_t count) {
+	memcpy(dst, src, count * sizeof(uint32_t));
 }
 
-bool OOPNG::IsFreed() {
-	return this->img == nullptr;
+// Widen four R5G6B5 pixels (in the low half of 32-bit lanes) to A8R8G8B8, the top bits of each channel are repeated into the new low ones.
+static inline __m128i expand565(__m128i p) {
+	__m128i r = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(p, _mm_set1_epi32(0xF800)), 8), _mm_slli_epi32(_mm_and_si128(p, _mm_set1_epi32(0xE000)), 3));
+	__m128i g = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(p, _mm_set1_epi32(0x07E0)), 5), _mm_srli_epi32(_mm_and_si128(p, _mm_set1_epi32(0x0600)), 1));
+	__m128i b = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(p, _mm_set1_epi32(0x001F)), 3), _mm_srli_epi32(_mm_and_si128(p, _mm_set1_epi32(0x001C)), 2));
+	return _mm_or_si128(_mm_or_si128(r, g), _mm_or_si128(b, _mm_set1_epi32(static_cast<int>(0x80000000))));
 }
 
-void OOPNG::DrawPart(OOScene2D& scene, int startX, int startY, int left, int top, int width, int height) {
-	// Don't draw non-existant images
-	if (this->img == nullptr) {
-		OOCRASHMSG("Trying to draw a non-existant image!");
+static inline uint32_t expand565(uint16_t p) {
+	uint32_t r = ((p & 0xF800) << 8) | ((p & 0xE000) << 3);
+	uint32_t g = ((p & 0x07E0) << 5) | ((p & 0x0600) >> 1);
+	uint32_t b = ((p & 0x001F) << 3) | ((p & 0x001C) >> 2);
+	return 0x80000000 | r | g | b;
+}
+
+// Convert `count` R5G6B5 pixels to the frame buffer format, `stream` makes the stores non-temporal.
+static void expandSpan(uint32_t *dst, const uint16_t *src, size_t count, bool stream) {
+	__m128i zero = _mm_setzero_si128();
+
+	// Scalar head until dst is 16-byte aligned, streaming stores need it
+	while (count > 0 && (reinterpret_cast<uintptr_t>(dst) & 15) != 0) {
+		*dst++ = expand565(*src++);
+		count--;
 	}
 
-	// error checking.
-	if (width > this->width || height > this->height || width < 0 || height < 0) {
-		OOCRASHMSG("Invalid width/height passed to DrawPart.");
+	for (; count >= 8; count -= 8, dst += 8, src += 8) {
+		__m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+		__m128i lo = expand565(_mm_unpacklo_epi16(p, zero));
+		__m128i hi = expand565(_mm_unpackhi_epi16(p, zero));
+
+		if (stream) {
+			_mm_stream_si128(reinterpret_cast<__m128i *>(dst), lo);
+			_mm_stream_si128(reinterpret_cast<__m128i *>(dst + 4), hi);
+		}
+		else {
+			_mm_store_si128(reinterpret_cast<__m128i *>(dst), lo);
+			_mm_store_si128(reinterpret_cast<__m128i *>(dst + 4), hi);
+		}
 	}
 
-	// Iterate the bitmap and draw the pixels
-	for (int yPos = top; yPos < height; yPos++) {
-		for (int xPos = left; xPos < width; xPos++) {
-			// Decode the 32-bit color
-			uint32_t encodedColor = this->img[(yPos * this->width) + xPos];
+	// Scalar tail
+	for (; count > 0; count--) {
+		*dst++ = expand565(*src++);
+	}
 
-			// Get new pixel coordinates to account for start coordinates
-			int x = startX + xPos;
-			int y = startY + yPos;
+	if (stream) {
+		_mm_sfence();
+	}
+}
 
-			// Re-encode the color
-			uint8_t r = (uint8_t)(encodedColor >> 0);
-			uint8_t g = (uint8_t)(encodedColor >> 8);
-			uint8_t b = (uint8_t)(encodedColor >> 16);
+// Alpha blend `count` A8R8G8B8 pixels from `src` over `dst`, using the source alpha.
+// Two pixels are widened to 16-bit lanes per register, so four are done per iteration.
+static void blendSpan(uint32_t *dst, const uint32_t *src, size_t count) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i full = _mm_set1_epi16(255);
+	__m128i half = _mm_set1_epi16(128);
+
+	for (; count >= 4; count -= 4, dst += 4, src += 4) {
+		__m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+		__m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst));
+
+		__m128i sLo = _mm_unpacklo_epi8(s, zero);
+		__m128i sHi = _mm_unpackhi_epi8(s, zero);
+		__m128i dLo = _mm_unpacklo_epi8(d, zero);
+		__m128i dHi = _mm_unpackhi_epi8(d, zero);
+
+		// broadcast each pixel's alpha to all of its four lanes
+		__m128i aLo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(sLo, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+		__m128i aHi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(sHi, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+
+		// src * a + dst * (255 - a), then a rounded division by 255
+		__m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(sLo, aLo), _mm_mullo_epi16(dLo, _mm_sub_epi16(full, aLo))), half);
+		__m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(sHi, aHi), _mm_mullo_epi16(dHi, _mm_sub_epi16(full, aHi))), half);
+		lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+		hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_packus_epi16(lo, hi));
+	}
 
-			Color color = { r, g, b, 255 };
+	// Scalar tail, same math
+	for (; count > 0; count--, dst++, src++) {
+		uint32_t a = *src >> 24;
+		uint32_t result = 0;
 
-			scene.DrawPixel(x, y, color);
+		for (int shift = 0; shift < 32; shift += 8) {
+			uint32_t c = (((*src >> shift) & 0xFF) * a) + (((*dst >> shift) & 0xFF) * (255 - a)) + 128;
+			result |= (((c + (c >> 8)) >> 8) & 0xFF) << shift;
 		}
+
+		*dst = result;
 	}
 }
 
-void OOPNG::Draw(OOScene2D& scene, int startX, int startY) {
-	this->DrawPart(scene, startX, startY, 0, 0, this->width, this->height);
-}
+// Blend a solid color over `count` pixels at `dst`, weighted by 8-bit coverage.
+// Runs of four empty pixels are skipped and four fully covered ones are just stored.
+static void blendCoverageSpan(uint32_t *dst, const uint8_t *coverage, uint32_t encodedColor, size_t count) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i full = _mm_set1_epi16(255);
+	__m128i half = _mm_set1_epi16(128);
+	__m128i solid = _mm_set1_epi32(static_cast<int>(encodedColor));
+	__m128i color = _mm_unpacklo_epi8(solid, zero);
 
-#pragma endregion
+	for (; count >= 4; count -= 4, dst += 4, coverage += 4) {
+		uint32_t cov4;
+		memcpy(&cov4, coverage, sizeof(cov4));
 
-#pragma region // OOScene2D
+		if (cov4 == 0) {
+			continue;
+		}
 
-OOScene2D::OOScene2D() {
-	// zero-out pointers and variables.
-	this->width = 0;
-	this->height = 0;
-	this->depth = 0;
-	this->frameBufferSize = 0;
-	this->activeFrameBufferIdx = 0;
-	this->frameID = 0;
-	this->videoMem = nullptr;
-	this->videoMemSP = nullptr;
-}
+		if (cov4 == UINT32_MAX) {
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(dst), solid);
+			continue;
+		}
 
-OOScene2D::~OOScene2D() {
-	sceVideoOutClose(this->video);
-	sceKernelDeleteEqueue(this->flipQueue);
-	this->deallocateVideoMem();
-	DEBUGLOG << "[DEBUG] [SCENE2D] Scene2D freed!";
+		// spread each coverage byte over the four lanes of its pixel
+		__m128i c = _mm_unpacklo_epi8(_mm_cvtsi32_si128(static_cast<int>(cov4)), zero);
+		c = _mm_unpacklo_epi16(c, c);
+		__m128i cLo = _mm_unpacklo_epi32(c, c);
+		__m128i cHi = _mm_unpackhi_epi32(c, c);
 
-	FT_Done_FreeType(this->ftLib);
-	DEBUGLOG << "[DEBUG] [SCENE2D] FreeType freed!";
-}
+		__m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst));
+		__m128i dLo = _mm_unpacklo_epi8(d, zero);
+		__m128i dHi = _mm_unpackhi_epi8(d, zero);
 
-bool OOScene2D::Init(int w, int h, int pixelDepth, size_t memSize, int numFrameBuffers) {
-	int rc;
+		// color * coverage + dst * (255 - coverage), then a rounded division by 255
+		__m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(color, cLo), _mm_mullo_epi16(dLo, _mm_sub_epi16(full, cLo))), half);
+		__m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(color, cHi), _mm_mullo_epi16(dHi, _mm_sub_epi16(full, cHi))), half);
+		lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+		hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
 
-	this->width = w;
-	this->height = h;
-	this->depth = pixelDepth;
-	this->frameBufferSize = this->width * this->height * this->depth;
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_packus_epi16(lo, hi));
+	}
 
-	this->video = sceVideoOutOpen(ORBIS_VIDEO_USER_MAIN, ORBIS_VIDEO_OUT_BUS_MAIN, 0, 0);
+	// Scalar tail, same math
+	for (; count > 0; count--, dst++, coverage++) {
+		uint32_t a = *coverage;
+		if (a == 0) {
+			continue;
+		}
 
-	if (this->video < 0) {
-		DEBUGLOG << "[DEBUG] [SCENE2D] Failed to open a video out handle: " << std::string(strerror(errno));
-		return false;
+		uint32_t result = 0;
+		for (int shift = 0; shift < 32; shift += 8) {
+			uint32_t c = (((encodedColor >> shift) & 0xFF) * a) + (((*dst >> shift) & 0xFF) * (255 - a)) + 128;
+			result |= (((c + (c >> 8)) >> 8) & 0xFF) << shift;
+		}
+
+		*dst = result;
 	}
+}
 
-	// Load freetype
-	rc = sceSysmoduleLoadModule(0x009A);
+// R5G6B5 versions of the blends: widen a chunk of the destination, blend it like a 32-bit one and narrow it back.
+// Narrowing a widened pixel gives the same pixel, so untouched ones come out unchanged.
+static void blendSpan(uint16_t *dst, const uint32_t *src, size_t count) {
+	uint32_t wide[BLEND_CHUNK];
 
-	if (rc != ORBIS_OK) {
-		DEBUGLOG << "[DEBUG] [SCENE2D] Failed to load freetype: " << std::string(strerror(errno));
-		return false;
+	while (count > 0) {
+		size_t n = std::min(count, static_cast<size_t>(BLEND_CHUNK));
+		expandSpan(wide, dst, n, false);
+		blendSpan(wide, src, n);
+		copySpan(dst, wide, n);
+
+		dst += n;
+		src += n;
+		count -= n;
 	}
+}
 
-	// Initialize freetype
-	rc = FT_Init_FreeType(&this->ftLib);
+static void blendCoverageSpan(uint16_t *dst, const uint8_t *coverage, uint32_t encodedColor, size_t count) {
+	uint32_t wide[BLEND_CHUNK];
 
-	if (rc != ORBIS_OK) {
-		DEBUGLOG << "[DEBUG] [SCENE2D] Failed to initialize freetype: " << std::string(strerror(errno));
-		return false;
+	while (count > 0) {
+		size_t n = std::min(count, static_cast<size_t>(BLEND_CHUNK));
+		expandSpan(wide, dst, n, false);
+		blendCoverageSpan(wide, coverage, encodedColor, n);
+		copySpan(dst, wide, n);
+
+		dst += n;
+		coverage += n;
+		count -= n;
 	}
+}
 
-	if (!initFlipQueue()) {
-		DEBUGLOG << "[DEBUG] [SCENE2D] Failed to initialize flip queue: " << std::string(strerror(errno));
-		return false;
+// Read `count` pixels of a row of `target` as A8R8G8B8.
+static void readSpan(const OORenderTarget& target, int x, int y, uint32_t *out, size_t count) {
+	size_t offset = (static_cast<size_t>(y) * target.pitch) + x;
+
+	switch (target.format) {
+	case PIXEL_R5G6B5:
+		expandSpan(out, static_cast<const uint16_t *>(target.pixels) + offset, count, false);
+		break;
+
+	default:
+		memcpy(out, static_cast<const uint32_t *>(target.pixels) + offset, count * sizeof(uint32_t));
+		break;
 	}
+}
 
-	if (!allocateVideoMem(memSize, 0x200000)) {
-		DEBUGLOG << "[DEBUG] [SCENE2D] Failed to allocate video memory: " << std::string(strerror(errno));
-		return false;
+// Where each of `to` output pixels samples `from` input pixels, for one axis of an upscale. Pixel centers line up.
+// Linear taps mix in `next` by weight / 256, nearest ones always have a weight of 0.
+static void buildTaps(std::vector<OOScaleTap>& taps, int from, int to, bool linear) {
+	taps.resize(to);
+
+	for (int d = 0; d < to; d++) {
+		// center of output pixel d, in 1/256ths of an input pixel
+		int64_t center = (((2 * static_cast<int64_t>(d)) + 1) * from * 256) / (2 * static_cast<int64_t>(to));
+		OOScaleTap& tap = taps[d];
+
+		if (!linear) {
+			tap.src = std::min(static_cast<int>(center >> 8), from - 1);
+			tap.next = tap.src;
+			tap.weight = 0;
+			continue;
+		}
+
+		// between the centers of two input pixels, the edges just clamp
+		int64_t pos = std::max(center - 128, static_cast<int64_t>(0));
+		tap.src = static_cast<int>(pos >> 8);
+		tap.weight = static_cast<uint32_t>(pos & 0xFF);
+		if (tap.src >= from - 1) {
+			tap.src = from - 1;
+			tap.weight = 0;
+		}
+
+		tap.next = std::min(tap.src + 1, from - 1);
 	}
+}
 
-	if (!allocateFrameBuffers(numFrameBuffers)) {
-		DEBUGLOG << "[DEBUG] [SCENE2D] Failed to allocate frame buffers: " << std::string(strerror(errno));
-		return false;
+// Mix two rows of A8R8G8B8 pixels, `weight` / 256 of the way from a to b.
+static void lerpSpan(uint32_t *dst, const uint32_t *a, const uint32_t *b, uint32_t weight, size_t count) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i wa = _mm_set1_epi16(static_cast<short>(256 - weight));
+	__m128i wb = _mm_set1_epi16(static_cast<short>(weight));
+
+	for (; count >= 4; count -= 4, dst += 4, a += 4, b += 4) {
+		__m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a));
+		__m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b));
+
+		// at most 255 * 256, so the 16-bit lanes don't overflow
+		__m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(va, zero), wa), _mm_mullo_epi16(_mm_unpacklo_epi8(vb, zero), wb));
+		__m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(va, zero), wa), _mm_mullo_epi16(_mm_unpackhi_epi8(vb, zero), wb));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8)));
 	}
 
-	sceVideoOutSetFlipRate(this->video, 0);
-	return true;
+	// Scalar tail, same math
+	for (; count > 0; count--, dst++, a++, b++) {
+		uint32_t result = 0;
+		for (int shift = 0; shift < 32; shift += 8) {
+			result |= (((((*a >> shift) & 0xFF) * (256 - weight)) + (((*b >> shift) & 0xFF) * weight)) >> 8) << shift;
+		}
+
+		*dst = result;
+	}
 }
 
-bool OOScene2D::initFlipQueue() {
-	int rc = sceKernelCreateEqueue(&flipQueue, "OOToolkit Flip Queue");
+// Scale a row up with linear filtering, four output pixels per iteration.
+static void lerpRow(uint32_t *dst, const uint32_t *src, const OOScaleTap *taps, size_t count) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i full = _mm_set1_epi16(256);
 
-	if (rc < 0) {
-		return false;
+	for (; count >= 4; count -= 4, dst += 4, taps += 4) {
+		__m128i a = _mm_set_epi32(src[taps[3].src], src[taps[2].src], src[taps[1].src], src[taps[0].src]);
+		__m128i b = _mm_set_epi32(src[taps[3].next], src[taps[2].next], src[taps[1].next], src[taps[0].next]);
+
+		// every pixel's weight over its four channels
+		__m128i w = _mm_set_epi32(taps[3].weight, taps[2].weight, taps[1].weight, taps[0].weight);
+		w = _mm_or_si128(w, _mm_slli_epi32(w, 16));
+		__m128i wLo = _mm_unpacklo_epi32(w, w);
+		__m128i wHi = _mm_unpackhi_epi32(w, w);
+
+		__m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), _mm_sub_epi16(full, wLo)), _mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), wLo));
+		__m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), _mm_sub_epi16(full, wHi)), _mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), wHi));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8)));
 	}
 
-	sceVideoOutAddFlipEvent(flipQueue, this->video, 0);
-	return true;
+	for (; count > 0; count--, dst++, taps++) {
+		lerpSpan(dst, src + taps->src, src + taps->next, taps->weight, 1);
+	}
 }
 
-bool OOScene2D::allocateFrameBuffers(int num) {
-	// Allocate frame buffers array
-	this->frameBuffers = new char*[num];
-
-	// Set the display buffers
-	for (int i = 0; i < num; i++) {
-		this->frameBuffers[i] = this->allocateDisplayMem(this->frameBufferSize);
+// Scale a row up by picking the nearest pixel.
+static void pickRow(uint32_t *dst, const uint32_t *src, const OOScaleTap *taps, size_t count) {
+	for (; count > 0; count--) {
+		*dst++ = src[(taps++)->src];
 	}
+}
 
-	// Set SRGB pixel format
-	sceVideoOutSetBufferAttribute(&this->attr, 0x80000000, 1, 0, this->width, this->height, this->width);
+// Scale a row up by a whole number: every pixel is repeated `factor` times.
+static void repeatRow(uint32_t *dst, const uint32_t *src, int factor, size_t count) {
+	if (factor == 2) {
+		for (; count >= 4; count -= 4, dst += 8, src += 4) {
+			__m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_unpacklo_epi32(p, p));
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 4), _mm_unpackhi_epi32(p, p));
+		}
+	}
 
-	// Register the buffers to the video handle
-	return (sceVideoOutRegisterBuffers(this->video, 0, (void **)this->frameBuffers, num, &this->attr) == ORBIS_OK);
+	for (; count > 0; count--, src++) {
+		for (int i = 0; i < factor; i++) {
+			*dst++ = *src;
+		}
+	}
 }
 
-char *OOScene2D::allocateDisplayMem(size_t size) {
-	// Essentially just bump allocation
-	char *allocatedPtr = this->videoMemSP;
-	this->videoMemSP += size;
+// A row of `target` as A8R8G8B8, widened into `scratch` if it isn't already.
+static const uint32_t *widenRow(const OORenderTarget& target, int y, std::vector<uint32_t>& scratch) {
+	if (target.format == PIXEL_A8R8G8B8) {
+		return static_cast<const uint32_t *>(target.pixels) + (static_cast<size_t>(y) * target.pitch);
+	}
 
-	return allocatedPtr;
+	scratch.resize(target.width);
+	readSpan(target, 0, y, scratch.data(), target.width);
+	return scratch.data();
 }
 
-bool OOScene2D::allocateVideoMem(size_t size, int alignment) {
-	int rc;
+static inline int64_t floorDiv(int64_t a, int64_t b) {
+	int64_t q = a / b;
+	return (q * b != a && ((a < 0) != (b < 0))) ? q - 1 : q;
+}
 
-	// Align the allocation size
-	this->directMemAllocationSize = (size + alignment - 1) / alignment * alignment;
+// Narrow [i0, i1) down to the steps i where start + i * step lands in [0, limit), for 16.16 sprite coordinates.
+// Inside it, the coordinate needs no more bounds checks.
+static void clipSteps(int64_t start, int64_t step, int64_t limit, int& i0, int& i1) {
+	int64_t lo;
+	int64_t hi;
 
-	// Allocate memory for display buffer
-	rc = sceKernelAllocateDirectMemory(0, sceKernelGetDirectMemorySize(), this->directMemAllocationSize, alignment, 3, &this->directMemOff);
+	if (step == 0) {
+		if (start < 0 || start >= limit) {
+			i1 = i0;
+		}
 
-	if (rc < 0) {
-		this->directMemAllocationSize = 0;
-		return false;
+		return;
 	}
 
-	// Map the direct memory
-	rc = sceKernelMapDirectMemory(&this->videoMem, this->directMemAllocationSize, 0x33, 0, this->directMemOff, alignment);
+	if (step > 0) {
+		lo = floorDiv(-start + step - 1, step);
+		hi = floorDiv(limit - start + step - 1, step);
+	}
+	else {
+		lo = floorDiv(start - limit, -step) + 1;
+		hi = floorDiv(start, -step) + 1;
+	}
 
-	if (rc < 0) {
-		sceKernelReleaseDirectMemory(this->directMemOff, this->directMemAllocationSize);
+	i0 = static_cast<int>(std::max(lo, static_cast<int64_t>(i0)));
+	i1 = static_cast<int>(std::min(hi, static_cast<int64_t>(i1)));
+	i1 = std::max(i1, i0);
+}
 
-		this->directMemOff = 0;
-		this->directMemAllocationSize = 0;
+// Sample `count` sprite pixels into `out`, stepping (dudx, dvdx) from (u, v), all 16.16 and known to stay inside the sprite.
+// Addresses are made four at a time: sx and sy are packed into 16-bit pairs and madd does sy * pitch + sx,
+// so the pitch and height must fit into an int16_t.
+static void sampleSpan(uint32_t *out, const uint32_t *pixels, int pitch, uint32_t u, uint32_t v, int32_t dudx, int32_t dvdx, size_t count) {
+	__m128i uu = _mm_add_epi32(_mm_set1_epi32(static_cast<int>(u)), _mm_set_epi32(3 * dudx, 2 * dudx, dudx, 0));
+	__m128i vv = _mm_add_epi32(_mm_set1_epi32(static_cast<int>(v)), _mm_set_epi32(3 * dvdx, 2 * dvdx, dvdx, 0));
+	__m128i du = _mm_set1_epi32(4 * dudx);
+	__m128i dv = _mm_set1_epi32(4 * dvdx);
+	__m128i high = _mm_set1_epi32(static_cast<int>(0xFFFF0000));
+	__m128i scale = _mm_set1_epi32(static_cast<int>((static_cast<uint32_t>(pitch) << 16) | 1));
+	alignas(16) int32_t index[4];
+
+	for (; count >= 4; count -= 4, out += 4) {
+		__m128i pairs = _mm_or_si128(_mm_and_si128(vv, high), _mm_srli_epi32(uu, 16));
+		_mm_store_si128(reinterpret_cast<__m128i *>(index), _mm_madd_epi16(pairs, scale));
+
+		// no gathers in SSE2
+		out[0] = pixels[index[0]];
+		out[1] = pixels[index[1]];
+		out[2] = pixels[index[2]];
+		out[3] = pixels[index[3]];
+
+		uu = _mm_add_epi32(uu, du);
+		vv = _mm_add_epi32(vv, dv);
+	}
 
-		return false;
+	// Scalar tail, unsigned so stepping past the last pixel can't overflow
+	u = static_cast<uint32_t>(_mm_cvtsi128_si32(uu));
+	v = static_cast<uint32_t>(_mm_cvtsi128_si32(vv));
+	for (; count > 0; count--, out++, u += dudx, v += dvdx) {
+		*out = pixels[((v >> 16) * pitch) + (u >> 16)];
 	}
+}
 
-	// Set the stack pointer to the beginning of the buffer
-	this->videoMemSP = reinterpret_cast<char *>(this->videoMem);
+// Sample `count` pixels of one sprite row `width` texels wide, stepping dudx from u (16.16, inside the row).
+// Mirrors just reverse the texels, whole number scales (repeat > 0, see OOSpriteMapping) repeat each one.
+static void sampleRow(uint32_t *out, const uint32_t *row, int32_t width, uint32_t u, int32_t dudx, int32_t repeat, size_t count) {
+	if (std::abs(dudx) == 0x10000) {
+		// the 1:1 case blends the row directly, this is a mirror
+		const uint32_t *src = row + (u >> 16);
+		for (; count > 0; count--) {
+			*out++ = *src--;
+		}
 
-	return true;
-}
+		return;
+	}
 
-void OOScene2D::deallocateVideoMem() {
-	// Free the direct memory
-	sceKernelReleaseDirectMemory(this->directMemOff, this->directMemAllocationSize);
+	if (repeat > 1) {
+		// Every texel covers `repeat` pixels, the first one maybe fewer
+		int32_t dir = (dudx > 0) ? 1 : -1;
+		int32_t sx = u >> 16;
+		int32_t sub = static_cast<int32_t>(((u & 0xFFFF) * static_cast<uint64_t>(repeat)) >> 16);
+		size_t left = (dudx > 0) ? repeat - sub : sub + 1;
+		size_t size = repeat;
 
-	// Zero out meta data
-	this->videoMem = nullptr;
-	this->videoMemSP = nullptr;
-	this->directMemOff = 0;
-	this->directMemAllocationSize = 0;
+		for (; count > 0 && left > 0; count--, left--) {
+			*out++ = row[sx];
+		}
 
-	// Free the frame buffer array
-	delete this->frameBuffers;
+		sx += dir;
+
+		// Doubled, two texels make a store
+		if (size == 2) {
+			for (; count >= 8; count -= 4, out += 4, sx += 2 * dir) {
+				__m128i pair = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(row + ((dir > 0) ? sx : sx - 1)));
+				pair = (dir > 0) ? _mm_unpacklo_epi32(pair, pair) : _mm_shuffle_epi32(pair, _MM_SHUFFLE(0, 0, 1, 1));
+				_mm_storeu_si128(reinterpret_cast<__m128i *>(out), pair);
+			}
+		}
+
+		// Whole texels, 4 pixels a store. Short repeats spill into the next texel's pixels, which overwrites them.
+		// Stopping 4 short of the end keeps the stores inside `out`, and sx inside the row
+		for (; count >= size + 4; count -= size, out += size, sx += dir) {
+			__m128i texel = _mm_set1_epi32(static_cast<int>(row[sx]));
+			for (size_t r = 0; r < size; r += 4) {
+				_mm_storeu_si128(reinterpret_cast<__m128i *>(out + r), texel);
+			}
+		}
+
+		// dudx is rounded, so the clipped row can run a pixel past the last texel the exact scale reaches
+		for (left = size; count > 0; count--, left--) {
+			if (left == 0) {
+				sx += dir;
+				left = size;
+			}
+
+			*out++ = row[std::min(std::max(sx, 0), width - 1)];
+		}
+
+		return;
+	}
+
+	for (; count > 0; count--, u += dudx) {
+		*out++ = row[u >> 16];
+	}
+}
+
+// The overlap of two rectangles, empty (w or h of 0) if there is none.
+static inline OORect intersectRect(const OORect& a, const OORect& b) {
+	int x0 = std::max(a.x, b.x);
+	int y0 = std::max(a.y, b.y);
+	int x1 = std::min(a.x + a.w, b.x + b.w);
+	int y1 = std::min(a.y + a.h, b.y + b.h);
+	return { x0, y0, std::max(x1 - x0, 0), std::max(y1 - y0, 0) };
+}
+
+// SSE2 has no 32-bit min/max, select through a compare mask instead.
+static inline __m128i max32(__m128i a, __m128i b) {
+	__m128i greater = _mm_cmpgt_epi32(a, b);
+	return _mm_or_si128(_mm_and_si128(greater, a), _mm_andnot_si128(greater, b));
+}
+
+static inline __m128i min32(__m128i a, __m128i b) {
+	__m128i greater = _mm_cmpgt_epi32(a, b);
+	return _mm_or_si128(_mm_and_si128(greater, b), _mm_andnot_si128(greater, a));
+}
+
+// Clip `count` rectangles, given as separate x/y/w/h arrays, against `clip`. Four are done per iteration.
+// The visible part of each one is written to `out`, with w or h <= 0 if nothing is visible.
+static void clipRects(const int *x, const int *y, const int *w, const int *h, size_t count, const OORect& clip, OORect *out) {
+	__m128i clipX0 = _mm_set1_epi32(clip.x);
+	__m128i clipY0 = _mm_set1_epi32(clip.y);
+	__m128i clipX1 = _mm_set1_epi32(clip.x + clip.w);
+	__m128i clipY1 = _mm_set1_epi32(clip.y + clip.h);
+
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128i vx = _mm_loadu_si128(reinterpret_cast<const __m128i *>(x + i));
+		__m128i vy = _mm_loadu_si128(reinterpret_cast<const __m128i *>(y + i));
+		__m128i vw = _mm_loadu_si128(reinterpret_cast<const __m128i *>(w + i));
+		__m128i vh = _mm_loadu_si128(reinterpret_cast<const __m128i *>(h + i));
+
+		__m128i x0 = max32(vx, clipX0);
+		__m128i y0 = max32(vy, clipY0);
+		__m128i cw = _mm_sub_epi32(min32(_mm_add_epi32(vx, vw), clipX1), x0);
+		__m128i ch = _mm_sub_epi32(min32(_mm_add_epi32(vy, vh), clipY1), y0);
+
+		// Transpose into four x, y, w, h rectangles
+		__m128i xy01 = _mm_unpacklo_epi32(x0, y0);
+		__m128i xy23 = _mm_unpackhi_epi32(x0, y0);
+		__m128i wh01 = _mm_unpacklo_epi32(cw, ch);
+		__m128i wh23 = _mm_unpackhi_epi32(cw, ch);
+
+		__m128i *dst = reinterpret_cast<__m128i *>(out + i);
+		_mm_storeu_si128(dst + 0, _mm_unpacklo_epi64(xy01, wh01));
+		_mm_storeu_si128(dst + 1, _mm_unpackhi_epi64(xy01, wh01));
+		_mm_storeu_si128(dst + 2, _mm_unpacklo_epi64(xy23, wh23));
+		_mm_storeu_si128(dst + 3, _mm_unpackhi_epi64(xy23, wh23));
+	}
+
+	// Scalar tail
+	for (; i < count; i++) {
+		int x0 = std::max(x[i], clip.x);
+		int y0 = std::max(y[i], clip.y);
+		out[i] = { x0, y0, std::min(x[i] + w[i], clip.x + clip.w) - x0, std::min(y[i] + h[i], clip.y + clip.h) - y0 };
+	}
+}
+
+#pragma endregion
+
+#pragma region // OOPNG
+
+// Read a whole file into `out`.
+static bool readFile(const char *path, std::vector<unsigned char>& out) {
+	FILE *file = fopen(path, "rb");
+	if (file == nullptr) {
+		return false;
+	}
+
+	// ftell fails on things that can't seek, like pipes
+	long length = fseek(file, 0, SEEK_END) == 0 ? ftell(file) : -1;
+	if (length < 0 || fseek(file, 0, SEEK_SET) != 0) {
+		fclose(file);
+		return false;
+	}
+
+	out.resize(length);
+	bool ok = fread(out.data(), 1, out.size(), file) == out.size();
+	fclose(file);
+	return ok;
+}
+
+OOPNG::OOPNG(size_t bufsize, unsigned char* bufpng) : OOPNG() {
+	if (bufsize >= 4 && memcmp(bufpng, "qoif", 4) == 0) {
+		if (!this->decodeQOI(bufpng, bufsize)) {
+			OOCRASHMSG("Failed to load QOI image from memory.");
+		}
+
+		return;
+	}
+
+	this->img = reinterpret_cast<uint32_t *>(stbi_load_from_memory(bufpng, bufsize, &this->width, &this->height, &this->channels, STBI_rgb_alpha));
+
+	if (this->img == nullptr) {
+		OOCRASHMSG("Failed to load PNG image from memory.");
+		return;
+	}
+
+	this->encodePixels();
+	this->classifyRuns();
+	this->setOwnPixels();
+}
+
+OOPNG::OOPNG(const char *imagePath) : OOPNG() {
+	std::vector<std::string> messages;
+	bool ok = this->load(imagePath, messages);
+	for (const std::string& message : messages) {
+		DEBUGLOG << message;
+	}
+
+	if (!ok) {
+		OOCRASHMSG("Failed to load image.");
+	}
+}
+
+bool OOPNG::load(const char *imagePath, std::vector<std::string>& messages) {
+	// A baked copy next to the image loads without decoding, as long as it was baked from this image
+	if (this->loadBaked(OOPNG::BakedPath(imagePath).c_str(), imagePath, messages)) {
+		return true;
+	}
+
+	size_t length = strlen(imagePath);
+	if (length >= 4 && strcmp(imagePath + length - 4, ".qoi") == 0) {
+		std::vector<unsigned char> data;
+		if (!readFile(imagePath, data) || !this->decodeQOI(data.data(), data.size())) {
+			messages.push_back("[DEBUG] [PNG] Failed to load QOI image " + std::string(imagePath));
+			return false;
+		}
+
+		return true;
+	}
+
+	this->img = reinterpret_cast<uint32_t *>(stbi_load(imagePath, &this->width, &this->height, &this->channels, STBI_rgb_alpha));
+
+	if (this->img == nullptr) {
+		messages.push_back("[DEBUG] [PNG] Failed to load PNG image " + std::string(imagePath));
+		return false;
+	}
+
+	this->encodePixels();
+	this->classifyRuns();
+	this->setOwnPixels();
+	return true;
+}
+
+OOPNG::OOPNG(int w, int h, const Color *pixels) : OOPNG() {
+	// Color is laid out just like stb's RGBA output, and stb frees with free(), so this looks like any loaded image
+	this->width = w;
+	this->height = h;
+	this->channels = 4;
+	this->img = reinterpret_cast<uint32_t *>(malloc(static_cast<size_t>(w) * h * sizeof(uint32_t)));
+
+	if (this->img == nullptr) {
+		OOCRASHMSG("Failed to allocate PNG image.");
+		return;
+	}
+
+	memcpy(this->img, pixels, static_cast<size_t>(w) * h * sizeof(uint32_t));
+	this->encodePixels();
+	this->classifyRuns();
+	this->setOwnPixels();
+}
+
+OOPNG::OOPNG() {
+	this->width = 0;
+	this->height = 0;
+	this->channels = 0;
+	this->img = nullptr;
+	this->pixels = nullptr;
+	this->pitch = 0;
+	this->page = -1;
+	this->pageX = 0;
+	this->pageY = 0;
+	this->loading = false;
+	this->failed = false;
+}
+
+OOPNG::OOPNG(OOPNG&& other) noexcept : OOPNG() {
+	// steal the pixels, otherwise the vector in OOScene2D frees them when it grows.
+	*this = std::move(other);
+}
+
+OOPNG& OOPNG::operator=(OOPNG&& other) noexcept {
+	if (this == &other) {
+		return *this;
+	}
+
+	// only ever done to sprites that don't sit in a page, OOScene2D gives page space back itself
+	this->release();
+
+	this->width = other.width;
+	this->height = other.height;
+	this->channels = other.channels;
+	this->img = other.img;
+	this->pixels = other.pixels;
+	this->pitch = other.pitch;
+	this->page = other.page;
+	this->pageX = other.pageX;
+	this->pageY = other.pageY;
+	this->runs = std::move(other.runs);
+	this->rowRuns = std::move(other.rowRuns);
+	this->loading = other.loading;
+	this->failed = other.failed;
+
+	other.img = nullptr;
+	other.pixels = nullptr;
+	other.page = -1;
+	other.width = 0;
+	other.height = 0;
+	other.channels = 0;
+	other.loading = false;
+	other.failed = false;
+	return *this;
+}
+
+void OOPNG::setOwnPixels() {
+	this->pixels = this->img;
+	this->pitch = this->width;
+	this->page = -1;
+	this->pageX = 0;
+	this->pageY = 0;
+}
+
+void OOPNG::encodePixels() {
+	// stb gives us R,G,B,A bytes (0xAABBGGRR), the frame buffer wants 0xAARRGGBB, so swap R and B in place.
+	// Doing it once here means drawing is just a row copy.
+	size_t count = static_cast<size_t>(this->width) * this->height;
+	size_t i = 0;
+
+	__m128i maskAG = _mm_set1_epi32(0xFF00FF00);
+	__m128i maskB = _mm_set1_epi32(0x00FF0000);
+	__m128i maskR = _mm_set1_epi32(0x000000FF);
+
+	for (; i + 4 <= count; i += 4) {
+		__m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i *>(this->img + i));
+		__m128i ag = _mm_and_si128(px, maskAG);
+		__m128i b = _mm_srli_epi32(_mm_and_si128(px, maskB), 16);
+		__m128i r = _mm_slli_epi32(_mm_and_si128(px, maskR), 16);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(this->img + i), _mm_or_si128(ag, _mm_or_si128(r, b)));
+	}
+
+	for (; i < count; i++) {
+		uint32_t px = this->img[i];
+		this->img[i] = (px & 0xFF00FF00) | ((px >> 16) & 0xFF) | ((px & 0xFF) << 16);
+	}
+}
+
+OOPNG::~OOPNG() {
+	this->release();
+}
+
+void OOPNG::release() {
+	if (this->pixels != nullptr) {
+		DEBUGLOG << "[DEBUG] [PNG] Freeing image...";
+		if (this->img != nullptr) {
+			stbi_image_free(this->img);
+		}
+
+		// a packed sprite's page space is given back by OOScene2D
+		this->img = nullptr;
+		this->pixels = nullptr;
+		this->page = -1;
+
+		// also reset other properties just in case, and give the run memory back too.
+		std::vector<OOPixelRun>().swap(this->runs);
+		std::vector<int>().swap(this->rowRuns);
+		this->width = 0;
+		this->height = 0;
+		this->channels = 0;
+	}
+}
+
+void OOPNG::classifyRuns() {
+	// Split every row into opaque and partially transparent runs, so drawing can copy the former,
+	// blend only the latter and skip the fully transparent pixels entirely.
+	this->runs.clear();
+	this->rowRuns.resize(this->height + 1);
+
+	for (int yPos = 0; yPos < this->height; yPos++) {
+		const uint32_t *row = this->img + (yPos * this->width);
+		this->rowRuns[yPos] = this->runs.size();
+
+		int xPos = 0;
+		while (xPos < this->width) {
+			uint32_t alpha = row[xPos] >> 24;
+			int start = xPos;
+
+			if (alpha == 0) {
+				while (xPos < this->width && (row[xPos] >> 24) == 0) xPos++;
+				continue;
+			}
+
+			if (alpha == 0xFF) {
+				while (xPos < this->width && (row[xPos] >> 24) == 0xFF) xPos++;
+				this->runs.push_back({ start, xPos - start, false });
+			}
+			else {
+				while (xPos < this->width && (row[xPos] >> 24) != 0 && (row[xPos] >> 24) != 0xFF) xPos++;
+				this->runs.push_back({ start, xPos - start, true });
+			}
+		}
+	}
+
+	this->rowRuns[this->height] = this->runs.size();
+}
+
+bool OOPNG::decodeQOI(const unsigned char *data, size_t size) {
+	if (size < QOI_HEADER_SIZE + QOI_PADDING_SIZE || memcmp(data, "qoif", 4) != 0) {
+		return false;
+	}
+
+	uint32_t w = (data[4] << 24) | (data[5] << 16) | (data[6] << 8) | data[7];
+	uint32_t h = (data[8] << 24) | (data[9] << 16) | (data[10] << 8) | data[11];
+	int channels = data[12];
+
+	if (w == 0 || h == 0 || (channels != 3 && channels != 4) || h >= QOI_PIXELS_MAX / w) {
+		return false;
+	}
+
+	size_t count = static_cast<size_t>(w) * h;
+	uint32_t *out = reinterpret_cast<uint32_t *>(malloc(count * sizeof(uint32_t)));
+	if (out == nullptr) {
+		return false;
+	}
+
+	// Pixels are decoded straight into the frame buffer format (A8R8G8B8), there's no conversion pass afterwards.
+	// The padding at the end means a chunk that starts before it can be read in full without checks.
+	uint32_t index[64] = { };
+	uint32_t px = 0xFF000000;
+	size_t pos = QOI_HEADER_SIZE;
+	size_t end = size - QOI_PADDING_SIZE;
+	size_t i = 0;
+
+	while (i < count && pos < end) {
+		uint32_t b1 = data[pos++];
+
+		if (b1 == QOI_OP_RGB) {
+			px = (px & 0xFF000000) | (data[pos] << 16) | (data[pos + 1] << 8) | data[pos + 2];
+			pos += 3;
+		}
+		else if (b1 == QOI_OP_RGBA) {
+			px = (static_cast<uint32_t>(data[pos + 3]) << 24) | (data[pos] << 16) | (data[pos + 1] << 8) | data[pos + 2];
+			pos += 4;
+		}
+		else if ((b1 & 0xC0) == QOI_OP_INDEX) {
+			// already in the index, nothing to store
+			out[i++] = px = index[b1];
+			continue;
+		}
+		else if ((b1 & 0xC0) == QOI_OP_RUN) {
+			size_t run = std::min(static_cast<size_t>(b1 & 0x3F) + 1, count - i);
+			fillSpan(out + i, px, run, false);
+			i += run;
+			continue;
+		}
+		else {
+			uint32_t r = (px >> 16) & 0xFF;
+			uint32_t g = (px >> 8) & 0xFF;
+			uint32_t b = px & 0xFF;
+
+			if ((b1 & 0xC0) == QOI_OP_DIFF) {
+				r += ((b1 >> 4) & 3) - 2;
+				g += ((b1 >> 2) & 3) - 2;
+				b += (b1 & 3) - 2;
+			}
+			else {
+				uint32_t b2 = data[pos++];
+				uint32_t vg = (b1 & 0x3F) - 32;
+				r += vg - 8 + ((b2 >> 4) & 0x0F);
+				g += vg;
+				b += vg - 8 + (b2 & 0x0F);
+			}
+
+			px = (px & 0xFF000000) | ((r & 0xFF) << 16) | ((g & 0xFF) << 8) | (b & 0xFF);
+		}
+
+		index[((((px >> 16) & 0xFF) * 3) + (((px >> 8) & 0xFF) * 5) + ((px & 0xFF) * 7) + ((px >> 24) * 11)) % 64] = px;
+		out[i++] = px;
+	}
+
+	// A truncated stream repeats the last pixel, like the reference decoder
+	if (i < count) {
+		fillSpan(out + i, px, count - i, false);
+	}
+
+	this->img = out;
+	this->width = w;
+	this->height = h;
+	this->channels = channels;
+	this->classifyRuns();
+	this->setOwnPixels();
+	return true;
+}
+
+std::string OOPNG::BakedPath(const std::string& imagePath) {
+	// Swap the extension, if the file name has one
+	size_t dot = imagePath.find_last_of('.');
+	size_t slash = imagePath.find_last_of('/');
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+		return imagePath + SPRITE_FILE_EXT;
+	}
+
+	return imagePath.substr(0, dot) + SPRITE_FILE_EXT;
+}
+
+bool OOPNG::loadBaked(const char *path, const char *imagePath, std::vector<std::string>& messages) {
+	FILE *file = fopen(path, "rb");
+	if (file == nullptr) {
+		return false;
+	}
+
+	OOSpriteFileHeader header;
+	bool ok = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, "OOSP", 4) == 0 && header.version == SPRITE_FILE_VERSION;
+
+	// The image changed after it was baked, the bake is stale. Without the image there's nothing it can be stale against
+	struct stat image;
+	if (ok && stat(imagePath, &image) == 0 && (header.sourceSize != static_cast<uint64_t>(image.st_size) || header.sourceTime != static_cast<int64_t>(image.st_mtime))) {
+		messages.push_back("[DEBUG] [PNG] " + std::string(path) + " was baked from an older image, loading the image instead.");
+		fclose(file);
+		return false;
+	}
+
+	// The header is checked before anything is allocated from it, the rest of the file has to be exactly what it describes
+	long fileSize = (ok && fseek(file, 0, SEEK_END) == 0) ? ftell(file) : -1;
+	ok = ok && fileSize >= 0 && fseek(file, sizeof(header), SEEK_SET) == 0;
+	ok = ok && header.width > 0 && header.height > 0 && header.height <= SPRITE_FILE_PIXELS_MAX / header.width;
+	ok = ok && header.runCount >= 0 && header.runCount <= static_cast<int64_t>(header.width) * header.height;
+	ok = ok && static_cast<uint64_t>(fileSize) == sizeof(header) + ((static_cast<uint64_t>(header.height) + 1) * sizeof(int32_t)) +
+		(static_cast<uint64_t>(header.runCount) * sizeof(OOSpriteFileRun)) + (static_cast<uint64_t>(header.width) * header.height * sizeof(uint32_t));
+
+	std::vector<OOSpriteFileRun> fileRuns;
+	size_t count = 0;
+	if (ok) {
+		// Everything is read straight into place, there's nothing to decode
+		count = static_cast<size_t>(header.width) * header.height;
+		this->rowRuns.resize(header.height + 1);
+		fileRuns.resize(header.runCount);
+		this->img = reinterpret_cast<uint32_t *>(malloc(count * sizeof(uint32_t)));
+
+		ok = this->img != nullptr;
+		ok = ok && fread(this->rowRuns.data(), sizeof(int32_t), this->rowRuns.size(), file) == this->rowRuns.size();
+		ok = ok && fread(fileRuns.data(), sizeof(OOSpriteFileRun), fileRuns.size(), file) == fileRuns.size();
+		ok = ok && fread(this->img, sizeof(uint32_t), count, file) == count;
+	}
+
+	fclose(file);
+
+	// The blitter trusts the runs, so make sure they stay inside the image
+	ok = ok && this->rowRuns[0] == 0 && this->rowRuns[header.height] == header.runCount;
+	for (int yPos = 0; ok && yPos < header.height; yPos++) {
+		ok = this->rowRuns[yPos] <= this->rowRuns[yPos + 1];
+	}
+
+	for (size_t r = 0; ok && r < fileRuns.size(); r++) {
+		ok = fileRuns[r].start >= 0 && fileRuns[r].start < header.width && fileRuns[r].length > 0 && fileRuns[r].length <= header.width - fileRuns[r].start;
+	}
+
+	if (!ok) {
+		messages.push_back("[DEBUG] [PNG] " + std::string(path) + " isn't a valid sprite file, loading the image instead.");
+		free(this->img);
+		this->img = nullptr;
+		std::vector<int>().swap(this->rowRuns);
+		return false;
+	}
+
+	this->width = header.width;
+	this->height = header.height;
+	this->channels = header.channels;
+	this->runs.resize(fileRuns.size());
+	for (size_t r = 0; r < fileRuns.size(); r++) {
+		this->runs[r] = { fileRuns[r].start, fileRuns[r].length, fileRuns[r].blend != 0 };
+	}
+
+	this->setOwnPixels();
+	return true;
+}
+
+bool OOPNG::SaveBaked(const std::string& fname, const std::string& imagePath) {
+	if (this->pixels == nullptr) {
+		OOCRASHMSG("Trying to save a non-existant image!");
+	}
+
+	// Stamped with the image it was made from, so loading can tell when it's stale
+	struct stat image;
+	if (stat(imagePath.c_str(), &image) != 0) {
+		DEBUGLOG << "[DEBUG] [PNG] Failed to stat " << imagePath << ": " << std::string(strerror(errno));
+		return false;
+	}
+
+	FILE *file = fopen(fname.c_str(), "wb");
+	if (file == nullptr) {
+		DEBUGLOG << "[DEBUG] [PNG] Failed to open " << fname << ": " << std::string(strerror(errno));
+		return false;
+	}
+
+	OOSpriteFileHeader header = {
+		{ 'O', 'O', 'S', 'P' }, SPRITE_FILE_VERSION, this->width, this->height, this->channels, static_cast<int32_t>(this->runs.size()),
+		static_cast<uint64_t>(image.st_size), static_cast<int64_t>(image.st_mtime)
+	};
+	std::vector<OOSpriteFileRun> fileRuns;
+	for (const OOPixelRun& run : this->runs) {
+		fileRuns.push_back({ run.start, run.length, run.blend ? 1 : 0 });
+	}
+
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	ok = ok && fwrite(this->rowRuns.data(), sizeof(int32_t), this->rowRuns.size(), file) == this->rowRuns.size();
+	ok = ok && fwrite(fileRuns.data(), sizeof(OOSpriteFileRun), fileRuns.size(), file) == fileRuns.size();
+
+	// row by row, a packed sprite's rows aren't next to each other
+	for (int yPos = 0; ok && yPos < this->height; yPos++) {
+		ok = fwrite(this->pixels + (yPos * this->pitch), sizeof(uint32_t), this->width, file) == static_cast<size_t>(this->width);
+	}
+
+	fclose(file);
+
+	if (!ok) {
+		DEBUGLOG << "[DEBUG] [PNG] Failed to write " << fname;
+	}
+
+	return ok;
+}
+
+void OOPNG::GetInfo(SpriteDim& sdim) {
+	sdim.w = this->width;
+	sdim.h = this->height;
+	sdim.c = this->channels;
+}
+
+bool OOPNG::IsFreed() {
+	return this->pixels == nullptr;
+}
+
+bool OOPNG::clipPart(int& startX, int& startY, int& left, int& top, int& width, int& height) const {
+	// Don't draw non-existant images
+	if (this->pixels == nullptr) {
+		OOCRASHMSG("Trying to draw a non-existant image!");
+	}
+
+	// error checking.
+	if (width < 0 || height < 0) {
+		OOCRASHMSG("Invalid width/height passed to DrawPart.");
+	}
+
+	// Clip the source rectangle to the image, moving the destination along with it
+	if (left < 0) {
+		startX -= left;
+		width += left;
+		left = 0;
+	}
+
+	if (top < 0) {
+		startY -= top;
+		height += top;
+		top = 0;
+	}
+
+	width = std::min(width, this->width - left);
+	height = std::min(height, this->height - top);
+
+	return width > 0 && height > 0;
+}
+
+#pragma endregion
+
+#pragma region // OOGlyphCache
+
+bool OOGlyphCache::AtlasKey::operator==(const AtlasKey& other) const {
+	return this->face == other.face && this->size == other.size;
+}
+
+bool OOGlyphCache::CharKey::operator==(const CharKey& other) const {
+	return this->face == other.face && this->charCode == other.charCode;
+}
+
+size_t OOGlyphCache::KeyHash::operator()(const AtlasKey& key) const {
+	return std::hash<void *>()(key.face) ^ (static_cast<size_t>(key.size) * 31);
+}
+
+size_t OOGlyphCache::KeyHash::operator()(const CharKey& key) const {
+	return std::hash<void *>()(key.face) ^ (static_cast<size_t>(key.charCode) << 20);
+}
+
+OOGlyphCache::OOGlyphCache() {
+	this->budget = GLYPH_CACHE_BUDGET;
+	this->stamp = 0;
+}
+
+void OOGlyphCache::SetBudget(size_t bytes) {
+	// Atlases never shrink, a smaller budget only makes them evict earlier.
+	this->budget = bytes;
+}
+
+void OOGlyphCache::BeginBatch() {
+	// Glyphs fetched from now on stay put until the next batch, so a string can't evict its own glyphs.
+	this->stamp++;
+}
+
+void OOGlyphCache::initAtlas(OOGlyphAtlas& atlas, FT_Face face) {
+	// Every cell must fit the biggest glyph of the face, the scaled bounding box tells us how big that is.
+	if (FT_IS_SCALABLE(face)) {
+		atlas.cellWidth = (FT_MulFix(face->bbox.xMax - face->bbox.xMin, face->size->metrics.x_scale) >> 6) + 2;
+		atlas.cellHeight = (FT_MulFix(face->bbox.yMax - face->bbox.yMin, face->size->metrics.y_scale) >> 6) + 2;
+	}
+	else {
+		atlas.cellWidth = (face->size->metrics.max_advance >> 6) + 2;
+		atlas.cellHeight = (face->size->metrics.height >> 6) + 2;
+	}
+
+	atlas.columns = std::max(1, GLYPH_ATLAS_WIDTH / atlas.cellWidth);
+	atlas.pitch = atlas.columns * atlas.cellWidth;
+	atlas.cellCount = 0;
+}
+
+int OOGlyphCache::allocateCell(OOGlyphAtlas& atlas) {
+	if (!atlas.freeCells.empty()) {
+		int cell = atlas.freeCells.back();
+		atlas.freeCells.pop_back();
+		return cell;
+	}
+
+	// Evict the least recently used glyph if we're over the budget, unless it's used by the current batch.
+	size_t cellBytes = static_cast<size_t>(atlas.cellWidth) * atlas.cellHeight;
+	if (atlas.cellCount * cellBytes >= this->budget && !atlas.lru.empty() && atlas.lru.back().stamp != this->stamp) {
+		int cell = atlas.lru.back().cell;
+		atlas.entries.erase(atlas.lru.back().index);
+		atlas.lru.pop_back();
+		return cell;
+	}
+
+	// Grow the atlas by a row of cells, rows are appended at the bottom so existing glyphs don't move.
+	if (atlas.cellCount % atlas.columns == 0) {
+		atlas.pixels.resize(atlas.pixels.size() + (cellBytes * atlas.columns));
+	}
+
+	return atlas.cellCount++;
+}
+
+FT_UInt OOGlyphCache::charIndex(FT_Face face, unsigned long charCode) {
+	// Character to glyph index mapping is cached as well, a hit must not touch FreeType at all.
+	CharKey charKey = { face, charCode };
+	auto it = this->charIndices.find(charKey);
+	if (it != this->charIndices.end()) {
+		return it->second;
+	}
+
+	FT_UInt index = FT_Get_Char_Index(face, charCode);
+	this->charIndices.emplace(charKey, index);
+	return index;
+}
+
+OOGlyphAtlas& OOGlyphCache::atlasFor(FT_Face face) {
+	AtlasKey atlasKey = { face, (static_cast<uint32_t>(face->size->metrics.x_ppem) << 16) | face->size->metrics.y_ppem };
+	auto it = this->atlases.find(atlasKey);
+	if (it == this->atlases.end()) {
+		it = this->atlases.emplace(atlasKey, OOGlyphAtlas()).first;
+		this->initAtlas(it->second, face);
+	}
+
+	return it->second;
+}
+
+const OOGlyph *OOGlyphCache::Get(FT_Face face, unsigned long charCode) {
+	FT_UInt index = this->charIndex(face, charCode);
+	OOGlyphAtlas& atlas = this->atlasFor(face);
+
+	auto it = atlas.entries.find(index);
+	if (it != atlas.entries.end()) {
+		// Move to the front of the LRU list.
+		atlas.lru.splice(atlas.lru.begin(), atlas.lru, it->second);
+		it->second->stamp = this->stamp;
+		return &(it->second->glyph);
+	}
+
+	// Cache miss, load and render in 8-bit color
+	int cell = this->allocateCell(atlas);
+	atlas.lru.push_front({ index, cell, this->stamp, { } });
+	atlas.entries[index] = atlas.lru.begin();
+
+	OOGlyph& glyph = atlas.lru.front().glyph;
+	glyph.atlas = &atlas;
+	glyph.index = index;
+	glyph.atlasX = (cell % atlas.columns) * atlas.cellWidth;
+	glyph.atlasY = (cell / atlas.columns) * atlas.cellHeight;
+	glyph.width = 0;
+	glyph.rows = 0;
+	glyph.left = 0;
+	glyph.top = 0;
+	glyph.advance = 0;
+	glyph.rendered = false;
+
+	if (FT_Load_Glyph(face, index, FT_LOAD_DEFAULT) == 0 && FT_Render_Glyph(face->glyph, ft_render_mode_normal) == 0) {
+		FT_GlyphSlot slot = face->glyph;
+
+		// A bitmap bigger than the cell shouldn't happen, but crop it if it does.
+		glyph.width = std::min(static_cast<int>(slot->bitmap.width), atlas.cellWidth);
+		glyph.rows = std::min(static_cast<int>(slot->bitmap.rows), atlas.cellHeight);
+		glyph.left = slot->bitmap_left;
+		glyph.top = slot->bitmap_top;
+		glyph.advance = slot->advance.x >> 6;
+		glyph.rendered = true;
+
+		// Copy the bitmap into its cell, the slot's pitch may be wider than the glyph.
+		for (int yPos = 0; yPos < glyph.rows; yPos++) {
+			memcpy(&atlas.pixels[((glyph.atlasY + yPos) * atlas.pitch) + glyph.atlasX], slot->bitmap.buffer + (yPos * slot->bitmap.pitch), glyph.width);
+		}
+
+		atlas.advances[index] = glyph.advance;
+	}
+
+	return &glyph;
+}
+
+int OOGlyphCache::GetAdvance(FT_Face face, unsigned long charCode, FT_UInt *index) {
+	*index = this->charIndex(face, charCode);
+	OOGlyphAtlas& atlas = this->atlasFor(face);
+
+	auto it = atlas.advances.find(*index);
+	if (it != atlas.advances.end()) {
+		return it->second;
+	}
+
+	// Only load the outline to get the advance, there's no need to rasterize anything
+	int advance = 0;
+	if (FT_Load_Glyph(face, *index, FT_LOAD_DEFAULT) == 0) {
+		advance = face->glyph->advance.x >> 6;
+	}
+
+	atlas.advances[*index] = advance;
+	return advance;
+}
+
+int OOGlyphCache::GetKerning(FT_Face face, FT_UInt left, FT_UInt right) {
+	if (!FT_HAS_KERNING(face) || left == 0 || right == 0) {
+		return 0;
+	}
+
+	OOGlyphAtlas& atlas = this->atlasFor(face);
+	uint64_t pair = (static_cast<uint64_t>(left) << 32) | right;
+
+	auto it = atlas.kerning.find(pair);
+	if (it != atlas.kerning.end()) {
+		return it->second;
+	}
+
+	FT_Vector delta;
+	int kern = 0;
+	if (FT_Get_Kerning(face, left, right, FT_KERNING_DEFAULT, &delta) == 0) {
+		kern = delta.x >> 6;
+	}
+
+	atlas.kerning[pair] = kern;
+	return kern;
+}
+
+int OOGlyphCache::GetLineHeight(FT_Face face) {
+	// Baseline to baseline distance of the current size, no glyph needed
+	return face->size->metrics.height >> 6;
+}
+
+void OOGlyphCache::GetCellSize(FT_Face face, int& w, int& h) {
+	OOGlyphAtlas& atlas = this->atlasFor(face);
+	w = atlas.cellWidth;
+	h = atlas.cellHeight;
+}
+
+void OOGlyphCache::Purge(FT_Face face) {
+	// Forget everything about a face that's about to be freed, its address may be reused.
+	for (auto it = this->atlases.begin(); it != this->atlases.end();) {
+		if (it->first.face == face) {
+			it = this->atlases.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+
+	for (auto it = this->charIndices.begin(); it != this->charIndices.end();) {
+		if (it->first.face == face) {
+			it = this->charIndices.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+}
+
+#pragma endregion
+
+#pragma region // OOFlipQueue
+
+OOFlipQueue::~OOFlipQueue() {
+}
+
+#ifndef OOTOOLKIT_HEADLESS
+OOVideoOutFlipQueue::OOVideoOutFlipQueue(int videoHandle) {
+	this->video = videoHandle;
+	this->queue = { };
+}
+
+OOVideoOutFlipQueue::~OOVideoOutFlipQueue() {
+	sceKernelDeleteEqueue(this->queue);
+}
+
+bool OOVideoOutFlipQueue::Init() {
+	int rc = sceKernelCreateEqueue(&this->queue, "OOToolkit Flip Queue");
+
+	if (rc < 0) {
+		return false;
+	}
+
+	sceVideoOutAddFlipEvent(this->queue, this->video, 0);
+	return true;
+}
+
+bool OOVideoOutFlipQueue::Submit(int bufferIndex, int64_t flipArg) {
+	return sceVideoOutSubmitFlip(this->video, bufferIndex, ORBIS_VIDEO_OUT_FLIP_VSYNC, flipArg) == ORBIS_OK;
+}
+
+int64_t OOVideoOutFlipQueue::GetFlipArg() {
+	OrbisVideoOutFlipStatus flipStatus;
+	sceVideoOutGetFlipStatus(this->video, &flipStatus);
+	return flipStatus.flipArg;
+}
+
+bool OOVideoOutFlipQueue::WaitFlip() {
+	OrbisKernelEvent evt;
+	int count;
+
+	return sceKernelWaitEqueue(this->queue, &evt, 1, &count, 0) == ORBIS_OK;
+}
+
+bool OOVideoOutFlipQueue::GetFlipTime(int64_t flipArg, std::chrono::steady_clock::time_point& time) {
+	OrbisVideoOutFlipStatus flipStatus;
+	sceVideoOutGetFlipStatus(this->video, &flipStatus);
+
+	// The status only knows the latest flip
+	if (flipStatus.flipArg != flipArg) {
+		return false;
+	}
+
+	// processTime is on the process clock in microseconds, carry it over to steady_clock
+	uint64_t age = sceKernelGetProcessTime() - flipStatus.processTime;
+	time = std::chrono::steady_clock::now() - std::chrono::microseconds(age);
+	return true;
+}
+#endif
+
+OOSimulatedFlipQueue::OOSimulatedFlipQueue(int refreshRate) {
+	this->period = std::chrono::nanoseconds(1000000000 / refreshRate);
+	this->flipArg = -1;
+	this->displayedBuffer = -1;
+	this->events = 0;
+	this->stop = false;
+	this->vblankThread = std::thread(&OOSimulatedFlipQueue::vblankMain, this);
+}
+
+OOSimulatedFlipQueue::~OOSimulatedFlipQueue() {
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->stop = true;
+	}
+
+	this->cond.notify_all();
+	this->vblankThread.join();
+}
+
+void OOSimulatedFlipQueue::vblankMain() {
+	std::unique_lock<std::mutex> lock(this->mutex);
+	auto vblank = std::chrono::steady_clock::now() + this->period;
+
+	for (;;) {
+		if (this->cond.wait_until(lock, vblank, [this] { return this->stop; })) {
+			break;
+		}
+
+		auto now = vblank;
+		vblank += this->period;
+
+		// Like the real thing, one queued flip is shown per vblank
+		if (!this->pending.empty()) {
+			this->displayedBuffer = this->pending.front().first;
+			this->flipArg = this->pending.front().second;
+			this->pending.pop_front();
+			this->events++;
+
+			this->flipTimes.push_back({ this->flipArg, now });
+			if (this->flipTimes.size() > FLIP_TIME_HISTORY) {
+				this->flipTimes.pop_front();
+			}
+
+			this->cond.notify_all();
+		}
+	}
+}
+
+bool OOSimulatedFlipQueue::Submit(int bufferIndex, int64_t flipArg) {
+	std::lock_guard<std::mutex> lock(this->mutex);
+	this->pending.push_back({ bufferIndex, flipArg });
+	return true;
+}
+
+int64_t OOSimulatedFlipQueue::GetFlipArg() {
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return this->flipArg;
+}
+
+bool OOSimulatedFlipQueue::WaitFlip() {
+	std::unique_lock<std::mutex> lock(this->mutex);
+	this->cond.wait(lock, [this] { return this->events > 0 || this->stop; });
+
+	if (this->events == 0) {
+		return false;
+	}
+
+	// Flips that happened meanwhile are reported together, just like the event queue does
+	this->events = 0;
+	return true;
+}
+
+bool OOSimulatedFlipQueue::GetFlipTime(int64_t flipArg, std::chrono::steady_clock::time_point& time) {
+	std::lock_guard<std::mutex> lock(this->mutex);
+
+	for (const auto& flip : this->flipTimes) {
+		if (flip.first == flipArg) {
+			time = flip.second;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+int OOSimulatedFlipQueue::GetDisplayedBuffer() {
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return this->displayedBuffer;
+}
+
+#pragma endregion
+
+#pragma region // OOVideoAllocator
+
+OOVideoAllocator::OOVideoAllocator() {
+	this->base = nullptr;
+	this->size = 0;
+	this->first = nullptr;
+	this->flBitmap = 0;
+	memset(this->slBitmap, 0, sizeof(this->slBitmap));
+	memset(this->freeLists, 0, sizeof(this->freeLists));
+	this->usedBytes = 0;
+	this->peakBytes = 0;
+	this->freeCount = 0;
+}
+
+OOVideoAllocator::~OOVideoAllocator() {
+	this->destroy();
+}
+
+void OOVideoAllocator::destroy() {
+	Block *block = this->first;
+	while (block != nullptr) {
+		Block *next = block->nextPhys;
+		delete block;
+		block = next;
+	}
+
+	this->first = nullptr;
+	this->usedBlocks.clear();
+	this->flBitmap = 0;
+	memset(this->slBitmap, 0, sizeof(this->slBitmap));
+	memset(this->freeLists, 0, sizeof(this->freeLists));
+	this->usedBytes = 0;
+	this->freeCount = 0;
+}
+
+void OOVideoAllocator::Init(void *memory, size_t bytes) {
+	this->destroy();
+	this->base = reinterpret_cast<char *>(memory);
+	this->size = bytes / VIDEO_ALLOC_GRANULE * VIDEO_ALLOC_GRANULE;
+	this->peakBytes = 0;
+
+	// The whole region starts out as one free block
+	if (this->base != nullptr && this->size > 0) {
+		this->first = new Block{ 0, this->size, true, nullptr, nullptr, nullptr, nullptr };
+		this->insertFree(this->first);
+	}
+}
+
+void OOVideoAllocator::mapping(size_t bytes, int& fl, int& sl) {
+	// First level is the power of two, second level splits it into 2^VIDEO_ALLOC_SL_BITS linear steps
+	fl = 63 - __builtin_clzll(bytes);
+	sl = (bytes >> (fl - VIDEO_ALLOC_SL_BITS)) & ((1 << VIDEO_ALLOC_SL_BITS) - 1);
+}
+
+void OOVideoAllocator::insertFree(Block *block) {
+	int fl, sl;
+	mapping(block->size, fl, sl);
+
+	block->free = true;
+	block->prevFree = nullptr;
+	block->nextFree = this->freeLists[fl][sl];
+	if (block->nextFree != nullptr) {
+		block->nextFree->prevFree = block;
+	}
+
+	this->freeLists[fl][sl] = block;
+	this->flBitmap |= 1ULL << fl;
+	this->slBitmap[fl] |= 1U << sl;
+	this->freeCount++;
+}
+
+void OOVideoAllocator::removeFree(Block *block) {
+	int fl, sl;
+	mapping(block->size, fl, sl);
+
+	if (block->prevFree != nullptr) {
+		block->prevFree->nextFree = block->nextFree;
+	}
+	else {
+		this->freeLists[fl][sl] = block->nextFree;
+	}
+
+	if (block->nextFree != nullptr) {
+		block->nextFree->prevFree = block->prevFree;
+	}
+
+	if (this->freeLists[fl][sl] == nullptr) {
+		this->slBitmap[fl] &= ~(1U << sl);
+		if (this->slBitmap[fl] == 0) {
+			this->flBitmap &= ~(1ULL << fl);
+		}
+	}
+
+	block->free = false;
+	this->freeCount--;
+}
+
+OOVideoAllocator::Block *OOVideoAllocator::findFree(size_t bytes) {
+	// Round up to the next size class, so any block of the class found is big enough
+	int fl, sl;
+	mapping(bytes, fl, sl);
+	size_t rounded = bytes + (static_cast<size_t>(1) << (fl - VIDEO_ALLOC_SL_BITS)) - 1;
+	if (rounded < bytes) {
+		return nullptr;
+	}
+
+	mapping(rounded, fl, sl);
+
+	uint32_t slMap = this->slBitmap[fl] & (~0U << sl);
+	if (slMap == 0) {
+		// Nothing left in this power of two, take the smallest bigger one
+		uint64_t flMap = fl < 63 ? this->flBitmap & (~0ULL << (fl + 1)) : 0;
+		if (flMap == 0) {
+			return nullptr;
+		}
+
+		fl = __builtin_ctzll(flMap);
+		slMap = this->slBitmap[fl];
+	}
+
+	return this->freeLists[fl][__builtin_ctz(slMap)];
+}
+
+OOVideoAllocator::Block *OOVideoAllocator::split(Block *block, size_t bytes) {
+	// Cut the block after `bytes`, returns the rest
+	Block *rest = new Block{ block->offset + bytes, block->size - bytes, false, block, block->nextPhys, nullptr, nullptr };
+	if (block->nextPhys != nullptr) {
+		block->nextPhys->prevPhys = rest;
+	}
+
+	block->nextPhys = rest;
+	block->size = bytes;
+	return rest;
+}
+
+void *OOVideoAllocator::Allocate(size_t bytes, size_t alignment) {
+	if ((alignment & (alignment - 1)) != 0) {
+		OOCRASHMSG("Video memory alignment must be a power of two.");
+	}
+
+	if (bytes == 0 || bytes > this->size) {
+		return nullptr;
+	}
+
+	alignment = std::max(alignment, static_cast<size_t>(VIDEO_ALLOC_GRANULE));
+	bytes = (bytes + VIDEO_ALLOC_GRANULE - 1) / VIDEO_ALLOC_GRANULE * VIDEO_ALLOC_GRANULE;
+
+	// Blocks are only granule aligned, leave room to move the start up to the alignment
+	Block *block = this->findFree(bytes + alignment - VIDEO_ALLOC_GRANULE);
+	if (block == nullptr) {
+		return nullptr;
+	}
+
+	this->removeFree(block);
+
+	// The padding in front stays free as a block of its own
+	uintptr_t address = reinterpret_cast<uintptr_t>(this->base) + block->offset;
+	size_t padding = ((address + alignment - 1) / alignment * alignment) - address;
+	if (padding > 0) {
+		Block *aligned = this->split(block, padding);
+		this->insertFree(block);
+		block = aligned;
+	}
+
+	// And so does whatever is left after it
+	if (block->size - bytes >= VIDEO_ALLOC_GRANULE) {
+		this->insertFree(this->split(block, bytes));
+	}
+
+	this->usedBlocks[block->offset] = block;
+	this->usedBytes += block->size;
+	this->peakBytes = std::max(this->peakBytes, this->usedBytes);
+
+	return this->base + block->offset;
+}
+
+void OOVideoAllocator::Free(void *ptr) {
+	if (ptr == nullptr) {
+		return;
+	}
+
+	auto found = this->usedBlocks.find(reinterpret_cast<char *>(ptr) - this->base);
+	if (reinterpret_cast<char *>(ptr) < this->base || found == this->usedBlocks.end()) {
+		OOCRASHMSG("Freeing video memory that wasn't allocated.");
+	}
+
+	Block *block = found->second;
+	this->usedBlocks.erase(found);
+	this->usedBytes -= block->size;
+
+	// Merge with free neighbours, so free blocks never sit next to each other
+	Block *prev = block->prevPhys;
+	if (prev != nullptr && prev->free) {
+		this->removeFree(prev);
+		prev->size += block->size;
+		prev->nextPhys = block->nextPhys;
+		if (block->nextPhys != nullptr) {
+			block->nextPhys->prevPhys = prev;
+		}
+
+		delete block;
+		block = prev;
+	}
+
+	Block *next = block->nextPhys;
+	if (next != nullptr && next->free) {
+		this->removeFree(next);
+		block->size += next->size;
+		block->nextPhys = next->nextPhys;
+		if (next->nextPhys != nullptr) {
+			next->nextPhys->prevPhys = block;
+		}
+
+		delete next;
+	}
+
+	this->insertFree(block);
+}
+
+void OOVideoAllocator::GetStats(OOVideoMemStats& out) {
+	out.total = this->size;
+	out.used = this->usedBytes;
+	out.peak = this->peakBytes;
+	out.allocations = this->usedBlocks.size();
+	out.freeBlocks = this->freeCount;
+	out.largestFree = 0;
+
+	// findFree rounds a request up to the next size class, so the bottom of the highest class with a free block is the most it can hand out
+	if (this->flBitmap != 0) {
+		int fl = 63 - __builtin_clzll(this->flBitmap);
+		int sl = 31 - __builtin_clz(this->slBitmap[fl]);
+		size_t classSize = (static_cast<size_t>(1) << fl) + (static_cast<size_t>(sl) << (fl - VIDEO_ALLOC_SL_BITS));
+		out.largestFree = classSize / VIDEO_ALLOC_GRANULE * VIDEO_ALLOC_GRANULE;
+	}
+}
+
+#pragma endregion
+
+#pragma region // OOScene2D
+
+OOScene2D::OOScene2D() {
+	// zero-out pointers and variables.
+	this->width = 0;
+	this->height = 0;
+	this->displayWidth = 0;
+	this->displayHeight = 0;
+	this->scaleFilter = SCALE_NEAREST;
+	this->scaleRowIndex[0] = -1;
+	this->scaleRowIndex[1] = -1;
+	this->depth = 0;
+	this->renderFormat = PIXEL_A8R8G8B8;
+	this->clip = { };
+	this->frameBufferSize = 0;
+	this->activeFrameBufferIdx = 0;
+	this->frameID = 0;
+	this->frameBufferCount = 0;
+	this->dirtyTracking = true;
+	this->commandBuffering = false;
+	this->renderBusy = false;
+	this->renderStop = false;
+	this->renderBufferIdx = 0;
+	this->renderFrameID = 0;
+	this->tileColumns = 0;
+	this->tileRows = 0;
+	this->tileList = nullptr;
+	this->tileTarget = { };
+	this->nextTile = 0;
+	this->workerGeneration = 0;
+	this->workersRunning = 0;
+	this->workerStop = false;
+	this->loadsPending = 0;
+	this->loadStop = false;
+	this->presentMode = PRESENT_SYNC;
+	this->mailboxBuffer = -1;
+	this->presentStop = false;
+	this->frameStats = false;
+	this->drawStarted = false;
+	this->nextSample = 0;
+	this->flipsUntimed = 0;
+	this->framesShown = 0;
+	this->framesDropped = 0;
+	this->vsyncsMissed = 0;
+	this->videoMem = nullptr;
+	this->frameBuffers = nullptr;
+}
+
+OOScene2D::~OOScene2D() {
+	// Loads still in flight are dropped
+	this->stopLoaders();
+
+	// The render thread must be done with the frame buffers before they go away
+	this->SetCommandBuffering(false);
+	this->stopWorkers();
+	this->stopPresenter();
+
+	this->flipper.reset();
+#ifndef OOTOOLKIT_HEADLESS
+	sceVideoOutClose(this->video);
+#endif
+	this->deallocateVideoMem();
+	DEBUGLOG << "[DEBUG] [SCENE2D] Scene2D freed!";
+
+	FT_Done_FreeType(this->ftLib);
+	DEBUGLOG << "[DEBUG] [SCENE2D] FreeType freed!";
+}
+
+bool OOScene2D::Init(int w, int h, int pixelDepth, size_t memSize, int numFrameBuffers, int renderWidth, int renderHeight) {
+	int rc;
+
+	if (pixelDepth != 4 && pixelDepth != 2) {
+		DEBUGLOG << "[DEBUG] [SCENE2D] Unsupported pixel depth: " << pixelDepth;
+		return false;
+	}
+
+	// No internal resolution means drawing at the display's
+	if (renderWidth <= 0 || renderHeight <= 0) {
+		renderWidth = w;
+		renderHeight = h;
+	}
+
+	if (renderWidth > w || renderHeight > h) {
+		DEBUGLOG << "[DEBUG] [SCENE2D] Internal resolution " << renderWidth << "x" << renderHeight << " is bigger than the display's.";
+		return false;
+	}
+
+	// Everything is drawn at width x height, the frame buffers are displayWidth x displayHeight
+	this->width = renderWidth;
+	this->height = renderHeight;
+	this->displayWidth = w;
+	this->displayHeight = h;
+	this->depth = pixelDepth;
+	this->renderFormat = (pixelDepth == 2) ? PIXEL_R5G6B5 : PIXEL_A8R8G8B8;
+	this->clip = { 0, 0, this->width, this->height };
+	this->buildScaler();
+
+	// The display only scans out 32-bit buffers, a depth of 2 draws into a 16-bit back buffer that's widened on present
+	this->frameBufferSize = this->displayWidth * this->displayHeight * sizeof(uint32_t);
+
+#ifdef OOTOOLKIT_HEADLESS
+	// No display, flips are simulated at the refresh rate of the real one
+	rc = FT_Init_FreeType(&this->ftLib);
+
+	if (rc != 0) {
+		DEBUGLOG << "[DEBUG] [SCENE2D] Failed to initialize freetype: " << rc;
+		return false;
+	}
+
+	this->video = 0;
+	this->flipper.reset(new OOSimulatedFlipQueue(60));
+#else
+	this->video = sceVideoOutOpen(ORBIS_VIDEO_USER_MAIN, ORBIS_VIDEO_OUT_BUS_MAIN, 0, 0);
+
+	if (this->video < 0) {
+		DEBUGLOG << "[DEBUG] [SCENE2D] Failed to open a video out handle: " << std::string(strerror(errno));
+		return false;
+	}
+
+	// Load freetype
+	rc = sceSysmoduleLoadModule(0x009A);
+
+	if (rc != ORBIS_OK) {
+		DEBUGLOG << "[DEBUG] [SCENE2D] Failed to load freetype: " << std::string(strerror(errno));
+		return false;
+	}
+
+	// Initialize freetype
+	rc = FT_Init_FreeType(&this->ftLib);
+
+	if (rc != ORBIS_OK) {
+		DEBUGLOG << "[DEBUG] [SCENE2D] Failed to initialize freetype: " << std::string(strerror(errno));
+		return false;
+	}
+
+	OOVideoOutFlipQueue *videoOut = new OOVideoOutFlipQueue(this->video);
+	this->flipper.reset(videoOut);
+
+	if (!videoOut->Init()) {
+		DEBUGLOG << "[DEBUG] [SCENE2D] Failed to initialize flip queue: " << std::string(strerror(errno));
+		return false;
+	}
+#endif
+
+	if (!allocateVideoMem(memSize, VIDEO_MEM_ALIGN)) {
+		DEBUGLOG << "[DEBUG] [SCENE2D] Failed to allocate video memory: " << std::string(strerror(errno));
+		return false;
+	}
+
+	if (!allocateFrameBuffers(numFrameBuffers)) {
+		DEBUGLOG << "[DEBUG] [SCENE2D] Failed to allocate frame buffers: " << std::string(strerror(errno));
+		return false;
+	}
+
+#ifndef OOTOOLKIT_HEADLESS
+	sceVideoOutSetFlipRate(this->video, 0);
+#endif
+
+	// Those are made into the frame buffer's format and size when presented, so they need a back buffer to be drawn into
+	if (this->renderFormat == PIXEL_R5G6B5 || this->scaled()) {
+		this->SetCachedBackBuffer(true);
+	}
+
+	return true;
+}
+
+bool OOScene2D::allocateFrameBuffers(int num) {
+	// Allocate frame buffers array
+	this->frameBuffers = new char*[num];
+	this->frameBufferCount = num;
+
+	// Nobody knows what's in fresh video memory, so the first clear of every buffer has to be a full one
+	this->dirtyRects.assign(num, { { 0, 0, this->width, this->height } });
+
+	// Nothing has been presented yet, every buffer is free
+	this->bufferFrames.assign(num, -1);
+
+	// Set the display buffers
+	for (int i = 0; i < num; i++) {
+		this->frameBuffers[i] = reinterpret_cast<char *>(this->videoAllocator.Allocate(this->frameBufferSize, VIDEO_MEM_ALIGN));
+
+		if (this->frameBuffers[i] == nullptr) {
+			DEBUGLOG << "[DEBUG] [SCENE2D] Video memory can't fit frame buffer " << i;
+			return false;
+		}
+	}
+
+#ifdef OOTOOLKIT_HEADLESS
+	return true;
+#else
+	// Set SRGB pixel format
+	sceVideoOutSetBufferAttribute(&this->attr, 0x80000000, 1, 0, this->displayWidth, this->displayHeight, this->displayWidth);
+
+	// Register the buffers to the video handle
+	return (sceVideoOutRegisterBuffers(this->video, 0, (void **)this->frameBuffers, num, &this->attr) == ORBIS_OK);
+#endif
+}
+
+bool OOScene2D::allocateVideoMem(size_t size, int alignment) {
+	// Align the allocation size
+	this->directMemAllocationSize = (size + alignment - 1) / alignment * alignment;
+
+#ifdef OOTOOLKIT_HEADLESS
+	// A plain mapping, aligned like the direct memory would be: map extra and trim the ends
+	char *mapped = reinterpret_cast<char *>(mmap(nullptr, this->directMemAllocationSize + alignment, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+
+	if (mapped == MAP_FAILED) {
+		this->videoMem = nullptr;
+		this->directMemAllocationSize = 0;
+		return false;
+	}
+
+	char *aligned = reinterpret_cast<char *>((reinterpret_cast<uintptr_t>(mapped) + alignment - 1) / alignment * alignment);
+	if (aligned > mapped) {
+		munmap(mapped, aligned - mapped);
+	}
+
+	munmap(aligned + this->directMemAllocationSize, (mapped + alignment) - aligned);
+	this->videoMem = aligned;
+#else
+	// Allocate memory for display buffer
+	int rc = sceKernelAllocateDirectMemory(0, sceKernelGetDirectMemorySize(), this->directMemAllocationSize, alignment, 3, &this->directMemOff);
+
+	if (rc < 0) {
+		this->directMemAllocationSize = 0;
+		return false;
+	}
+
+	// Map the direct memory
+	rc = sceKernelMapDirectMemory(&this->videoMem, this->directMemAllocationSize, 0x33, 0, this->directMemOff, alignment);
+
+	if (rc < 0) {
+		sceKernelReleaseDirectMemory(this->directMemOff, this->directMemAllocationSize);
+
+		this->directMemOff = 0;
+		this->directMemAllocationSize = 0;
+
+		return false;
+	}
+#endif
+
+	this->videoAllocator.Init(this->videoMem, this->directMemAllocationSize);
+	return true;
+}
+
+void OOScene2D::deallocateVideoMem() {
+	// Everything handed out goes away with the region
+	this->videoAllocator.Init(nullptr, 0);
+
+#ifdef OOTOOLKIT_HEADLESS
+	if (this->videoMem != nullptr) {
+		munmap(this->videoMem, this->directMemAllocationSize);
+	}
+#else
+	// Free the direct memory
+	sceKernelReleaseDirectMemory(this->directMemOff, this->directMemAllocationSize);
+#endif
+
+	// Zero out meta data
+	this->videoMem = nullptr;
+	this->directMemOff = 0;
+	this->directMemAllocationSize = 0;
+
+	// Free the frame buffer array
+	delete[] this->frameBuffers;
 	this->frameBuffers = nullptr;
 }
 
-void OOScene2D::SetActiveFrameBuffer(int index) {
-	this->activeFrameBufferIdx = index;
-}
+void OOScene2D::SetActiveFrameBuffer(int index) {
+	this->activeFrameBufferIdx = index;
+}
+
+void OOScene2D::SubmitFlip(int frameID) {
+	this->submitFlip(this->activeFrameBufferIdx, frameID);
+}
+
+void OOScene2D::submitFlip(int bufferIndex, int frameID) {
+	{
+		std::lock_guard<std::mutex> lock(this->presentMutex);
+		this->bufferFrames[bufferIndex] = frameID;
+	}
+
+	this->flipper->Submit(bufferIndex, frameID);
+}
+
+void OOScene2D::FrameWait(int frameID) {
+	// If the flip queue is not initialized, bail out. This is mostly a failsafe, this should never happen.
+	if (!this->flipper) {
+		return;
+	}
+
+	// Frames dropped by the mailbox never show up, so anything newer counts too
+	this->waitDisplay([this, frameID] { return this->flipper->GetFlipArg() >= frameID; });
+}
+
+bool OOScene2D::bufferFree(int bufferIndex) {
+	// A buffer is free once a newer frame is on screen. Frame IDs only grow, so one compare covers displayed, queued and mailbox frames
+	int frame = this->bufferFrames[bufferIndex];
+	return frame < 0 || this->flipper->GetFlipArg() > frame;
+}
+
+void OOScene2D::waitDisplay(const std::function<bool()>& done) {
+	std::unique_lock<std::mutex> lock(this->presentMutex);
+
+	// The presenter owns the flip events in mailbox mode, it wakes us up after each flip
+	if (this->presentMode == PRESENT_MAILBOX) {
+		this->presentCond.wait(lock, done);
+		return;
+	}
+
+	while (!done()) {
+		lock.unlock();
+		bool flipped = this->flipper->WaitFlip();
+		this->observeFlips();
+		lock.lock();
+
+		if (!flipped) {
+			break;
+		}
+	}
+}
+
+void OOScene2D::acquireBuffer(int bufferIndex) {
+	this->waitDisplay([this, bufferIndex] { return this->bufferFree(bufferIndex); });
+}
+
+void OOScene2D::present(int bufferIndex, int frameID) {
+	this->stampPresent(frameID, false);
+
+	switch (this->presentMode) {
+	case PRESENT_SYNC:
+		this->submitFlip(bufferIndex, frameID);
+		this->FrameWait(frameID);
+		break;
+
+	case PRESENT_QUEUED:
+		// Whoever draws into this buffer next waits for it instead
+		this->submitFlip(bufferIndex, frameID);
+		break;
+
+	case PRESENT_MAILBOX: {
+		std::lock_guard<std::mutex> lock(this->presentMutex);
+
+		// The frame still waiting for its flip is stale now, its buffer can be drawn into again
+		if (this->mailboxBuffer >= 0) {
+			this->stampPresent(this->bufferFrames[this->mailboxBuffer], true);
+			this->bufferFrames[this->mailboxBuffer] = -1;
+		}
+
+		this->bufferFrames[bufferIndex] = frameID;
+		this->mailboxBuffer = bufferIndex;
+		this->presentCond.notify_all();
+		break;
+	}
+	}
+}
+
+void OOScene2D::presentThreadMain() {
+	std::unique_lock<std::mutex> lock(this->presentMutex);
+
+	for (;;) {
+		this->presentCond.wait(lock, [this] { return this->mailboxBuffer >= 0 || this->presentStop; });
+
+		// Show what's left in the mailbox before stopping
+		if (this->mailboxBuffer < 0) {
+			break;
+		}
+
+		int buffer = this->mailboxBuffer;
+		int frame = this->bufferFrames[buffer];
+		this->mailboxBuffer = -1;
+		lock.unlock();
+
+		// Only one flip is in flight, newer frames replace each other in the mailbox meanwhile
+		this->flipper->Submit(buffer, frame);
+
+		while (this->flipper->GetFlipArg() < frame) {
+			if (!this->flipper->WaitFlip()) {
+				break;
+			}
+
+			this->observeFlips();
+
+			// Every flip frees a buffer
+			lock.lock();
+			this->presentCond.notify_all();
+			lock.unlock();
+		}
+
+		lock.lock();
+		this->presentCond.notify_all();
+	}
+}
+
+void OOScene2D::startPresenter() {
+	if (this->presentMode == PRESENT_MAILBOX) {
+		this->presentStop = false;
+		this->presentThread = std::thread(&OOScene2D::presentThreadMain, this);
+	}
+}
+
+void OOScene2D::stopPresenter() {
+	if (!this->presentThread.joinable()) {
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(this->presentMutex);
+		this->presentStop = true;
+	}
+
+	this->presentCond.notify_all();
+	this->presentThread.join();
+}
+
+void OOScene2D::SetPresentMode(OOPresentMode mode) {
+	// Nothing may be presenting while the mode changes
+	this->waitRenderIdle();
+	this->stopPresenter();
+	this->presentMode = mode;
+	this->startPresenter();
+}
+
+void OOScene2D::SetFlipQueue(std::unique_ptr<OOFlipQueue> queue) {
+	this->waitRenderIdle();
+	this->stopPresenter();
+
+	// Frame IDs of the old queue mean nothing to the new one
+	this->flipper = std::move(queue);
+	std::fill(this->bufferFrames.begin(), this->bufferFrames.end(), -1);
+
+	this->startPresenter();
+}
+
+void OOScene2D::SetFrameStats(bool enable) {
+	std::lock_guard<std::mutex> lock(this->statsMutex);
+
+	// Start from scratch, whatever was measured before is stale
+	this->frameTimings.clear();
+	this->frameSamples.assign(FRAME_STATS_WINDOW, { });
+	this->nextSample = 0;
+	this->flipsUntimed = 0;
+	this->framesShown = 0;
+	this->framesDropped = 0;
+	this->vsyncsMissed = 0;
+	this->drawStarted = false;
+	this->frameStats = enable;
+}
+
+void OOScene2D::GetFrameStats(OOFrameStats& out) {
+	std::lock_guard<std::mutex> lock(this->statsMutex);
+	size_t count = std::min<size_t>(this->nextSample, FRAME_STATS_WINDOW);
+	std::vector<float> values;
+
+	// All the sorting happens here, measuring a frame is just a few timestamps
+	auto summarize = [&](float OOFrameSample::*field, OOTimingStats& stats) {
+		stats = { };
+		if (count == 0) {
+			return;
+		}
+
+		values.clear();
+		for (size_t i = 0; i < count; i++) {
+			values.push_back(this->frameSamples[i].*field);
+		}
+
+		std::sort(values.begin(), values.end());
+
+		double sum = 0;
+		for (float value : values) {
+			sum += value;
+		}
+
+		stats.min = values.front();
+		stats.avg = sum / count;
+		stats.p99 = values[std::min(count - 1, (count * 99) / 100)];
+	};
+
+	summarize(&OOFrameSample::draw, out.draw);
+	summarize(&OOFrameSample::frame, out.frame);
+	summarize(&OOFrameSample::present, out.present);
+	summarize(&OOFrameSample::interval, out.interval);
+	out.frames = this->framesShown;
+	out.droppedFrames = this->framesDropped;
+	out.missedVsyncs = this->vsyncsMissed;
+}
+
+void OOScene2D::stampPresent(int frameID, bool dropped) {
+	if (!this->frameStats) {
+		return;
+	}
+
+	auto now = std::chrono::steady_clock::now();
+	std::lock_guard<std::mutex> lock(this->statsMutex);
+
+	// It's one of the last few frames, so look from the back
+	for (auto it = this->frameTimings.rbegin(); it != this->frameTimings.rend(); ++it) {
+		if (it->frameID == frameID) {
+			if (dropped) {
+				it->dropped = true;
+			}
+			else {
+				it->submit = now;
+				it->presented = true;
+			}
+
+			break;
+		}
+	}
+}
+
+void OOScene2D::observeFlips() {
+	if (!this->frameStats) {
+		return;
+	}
+
+	int64_t flipArg = this->flipper->GetFlipArg();
+	std::lock_guard<std::mutex> lock(this->statsMutex);
+
+	// Everything up to the frame on screen is done with, one way or the other
+	while (!this->frameTimings.empty()) {
+		const OOFrameTiming& timing = this->frameTimings.front();
+		if (timing.frameID > flipArg || !(timing.presented || timing.dropped)) {
+			break;
+		}
+
+		std::chrono::steady_clock::time_point flipped;
+		if (timing.dropped) {
+			this->framesDropped++;
+		}
+		else if (!this->flipper->GetFlipTime(timing.frameID, flipped)) {
+			// Shown, but only some later flip knows when, that one accounts for this one's vblank too
+			this->flipsUntimed++;
+			this->framesShown++;
+		}
+		else {
+			OOFrameSample& sample = this->frameSamples[this->nextSample % FRAME_STATS_WINDOW];
+			sample.draw = std::chrono::duration<float, std::micro>(timing.lastDraw - timing.firstDraw).count();
+			sample.frame = std::chrono::duration<float, std::micro>(timing.submit - timing.firstDraw).count();
+			sample.present = std::chrono::duration<float, std::micro>(flipped - timing.submit).count();
+			sample.interval = VBLANK_PERIOD_US;
+
+			if (this->framesShown > 0) {
+				long flips = static_cast<long>(this->flipsUntimed) + 1;
+				float elapsed = std::chrono::duration<float, std::micro>(flipped - this->lastFlip).count();
+				sample.interval = elapsed / flips;
+
+				// Every vblank beyond one per flip showed the previous frame again
+				long vblanks = static_cast<long>((elapsed / VBLANK_PERIOD_US) + 0.5f);
+				if (vblanks > flips) {
+					this->vsyncsMissed += vblanks - flips;
+				}
+			}
+
+			this->nextSample++;
+			this->framesShown++;
+			this->flipsUntimed = 0;
+			this->lastFlip = flipped;
+		}
+
+		this->frameTimings.pop_front();
+	}
+}
+
+void OOScene2D::FrameBufferSwap() {
+	int next = (this->activeFrameBufferIdx + 1) % this->frameBufferCount;
+
+	// In mailbox mode any buffer the display is done with will do, the next one may well be on screen
+	if (this->presentMode == PRESENT_MAILBOX) {
+		auto findFree = [this, &next] {
+			for (int i = 1; i < this->frameBufferCount; i++) {
+				int idx = (this->activeFrameBufferIdx + i) % this->frameBufferCount;
+				if (this->bufferFree(idx)) {
+					next = idx;
+					return true;
+				}
+			}
+
+			return false;
+		};
+
+		// The render thread waits for the buffer itself, before it draws the recorded frame
+		if (this->commandBuffering) {
+			std::lock_guard<std::mutex> lock(this->presentMutex);
+			findFree();
+		}
+		else {
+			this->waitDisplay(findFree);
+		}
+
+		this->activeFrameBufferIdx = next;
+		return;
+	}
+
+	this->activeFrameBufferIdx = next;
+
+	if (!this->commandBuffering) {
+		this->acquireBuffer(next);
+	}
+}
+
+void OOScene2D::FrameBufferClear() {
+	if (!this->dirtyTracking) {
+		// Clear the screen with a black frame buffer
+		this->FrameBufferFill(COLOR_BLACK);
+		return;
+	}
+
+	// The buffer is black except for what was drawn into it last time, only clear that
+	std::vector<OORect>& dirty = this->dirtyList();
+
+	for (const OORect& rect : dirty) {
+		this->markRows(rect.y, rect.y + rect.h);
+		this->submit({ DRAW_FILL, rect.x, rect.y, rect.w, rect.h, 0, 0, 0, COLOR_BLACK, 0 });
+	}
+
+	dirty.clear();
+}
+
+void OOScene2D::SetDirtyTracking(bool enable) {
+	// Draws weren't recorded while tracking was off, so start over with full clears
+	if (enable && !this->dirtyTracking) {
+		for (auto& dirty : this->dirtyRects) {
+			dirty.assign(1, { 0, 0, this->width, this->height });
+		}
+	}
+
+	this->dirtyTracking = enable;
+}
+
+void OOScene2D::markDirty(int x0, int y0, int x1, int y1) {
+	// The back buffer needs to know about every draw, tracked or not
+	this->markRows(y0, y1);
+
+	if (!this->dirtyTracking) {
+		return;
+	}
+
+	std::vector<OORect>& dirty = this->dirtyList();
+
+	// Already covered?
+	for (const OORect& rect : dirty) {
+		if (x0 >= rect.x && y0 >= rect.y && x1 <= rect.x + rect.w && y1 <= rect.y + rect.h) {
+			return;
+		}
+	}
+
+	if (dirty.size() < DIRTY_RECT_MAX) {
+		dirty.push_back({ x0, y0, x1 - x0, y1 - y0 });
+		return;
+	}
+
+	// Out of rectangles, grow the one that needs to grow the least
+	OORect *best = nullptr;
+	long bestGrowth = 0;
+	for (OORect& rect : dirty) {
+		long ux0 = std::min(x0, rect.x);
+		long uy0 = std::min(y0, rect.y);
+		long ux1 = std::max(x1, rect.x + rect.w);
+		long uy1 = std::max(y1, rect.y + rect.h);
+		long growth = ((ux1 - ux0) * (uy1 - uy0)) - (static_cast<long>(rect.w) * rect.h);
+
+		if (best == nullptr || growth < bestGrowth) {
+			best = &rect;
+			bestGrowth = growth;
+		}
+	}
+
+	int ux0 = std::min(x0, best->x);
+	int uy0 = std::min(y0, best->y);
+	best->w = std::max(x1, best->x + best->w) - ux0;
+	best->h = std::max(y1, best->y + best->h) - uy0;
+	best->x = ux0;
+	best->y = uy0;
+}
+
+std::vector<OORect>& OOScene2D::dirtyList() {
+	// All frames are drawn into the back buffer, so it has just the one history
+	return this->dirtyRects[this->backBuffer.empty() ? this->activeFrameBufferIdx : 0];
+}
+
+void OOScene2D::markRows(int y0, int y1) {
+	if (this->backBuffer.empty()) {
+		return;
+	}
+
+	y0 = std::max(y0, 0);
+	y1 = std::min(y1, this->height);
+	if (y0 < y1) {
+		memset(&this->recordList.rows[y0], 1, y1 - y0);
+	}
+}
+
+void OOScene2D::SetCachedBackBuffer(bool enable) {
+	if (enable == !this->backBuffer.empty()) {
+		return;
+	}
+
+	if (!enable && (this->renderFormat != PIXEL_A8R8G8B8 || this->scaled())) {
+		DEBUGLOG << "[DEBUG] [SCENE2D] 16-bit and scaled frames can only be drawn into a back buffer.";
+		return;
+	}
+
+	// Nothing may be drawing while the target changes
+	this->flushCommands();
+	this->waitRenderIdle();
+
+	uint32_t *active = reinterpret_cast<uint32_t *>(this->frameBuffers[this->activeFrameBufferIdx]);
+	size_t pixels = static_cast<size_t>(this->width) * this->height;
+
+	if (enable) {
+		// Carry over what this frame has drawn so far, no frame buffer matches the back buffer yet
+		this->backBuffer.assign(pixels * pixelSize(this->renderFormat), 0);
+		if (this->scaled()) {
+			// a different size, nothing to carry over
+		}
+		else if (this->renderFormat == PIXEL_R5G6B5) {
+			copySpan(reinterpret_cast<uint16_t *>(this->backBuffer.data()), active, pixels);
+		}
+		else {
+			copySpan(reinterpret_cast<uint32_t *>(this->backBuffer.data()), active, pixels);
+		}
+
+		this->staleRows.assign(this->frameBufferCount, std::vector<uint8_t>(this->height, 1));
+		this->recordList.rows.assign(this->height, 0);
+		this->renderList.rows.assign(this->height, 0);
+	}
+	else {
+		// Drawing goes on in the active frame buffer, so it gets the frame so far
+		streamSpan(active, reinterpret_cast<const uint32_t *>(this->backBuffer.data()), pixels);
+
+		std::vector<uint8_t>().swap(this->backBuffer);
+		this->staleRows.clear();
+		this->recordList.rows.clear();
+		this->renderList.rows.clear();
+	}
+
+	// The dirty lists were kept for other memory, start over with full clears
+	for (auto& dirty : this->dirtyRects) {
+		dirty.assign(1, { 0, 0, this->width, this->height });
+	}
+}
+
+void OOScene2D::resolveBackBuffer(int bufferIndex, std::vector<uint8_t>& rows) {
+	if (this->backBuffer.empty()) {
+		return;
+	}
+
+	// Rows drawn this frame are out of date in every frame buffer
+	for (auto& stale : this->staleRows) {
+		for (int y = 0; y < this->height; y++) {
+			stale[y] |= rows[y];
+		}
+	}
+
+	std::fill(rows.begin(), rows.end(), 0);
+
+	std::vector<uint8_t>& stale = this->staleRows[bufferIndex];
+	uint32_t *dst = reinterpret_cast<uint32_t *>(this->frameBuffers[bufferIndex]);
+
+	if (this->scaled()) {
+		this->upscaleRows(dst, stale);
+		std::fill(stale.begin(), stale.end(), 0);
+		return;
+	}
+
+	// Stream the ones this buffer is missing, runs of rows are contiguous and go in one copy
+
+	for (int y = 0; y < this->height;) {
+		if (!stale[y]) {
+			y++;
+			continue;
+		}
+
+		int end = y + 1;
+		while (end < this->height && stale[end]) {
+			end++;
+		}
+
+		size_t offset = static_cast<size_t>(y) * this->width;
+		size_t count = static_cast<size_t>(end - y) * this->width;
+		if (this->renderFormat == PIXEL_R5G6B5) {
+			expandSpan(dst + offset, reinterpret_cast<const uint16_t *>(this->backBuffer.data()) + offset, count, true);
+		}
+		else {
+			streamSpan(dst + offset, reinterpret_cast<const uint32_t *>(this->backBuffer.data()) + offset, count);
+		}
+
+		y = end;
+	}
+
+	std::fill(stale.begin(), stale.end(), 0);
+}
+
+bool OOScene2D::scaled() {
+	return this->width != this->displayWidth || this->height != this->displayHeight;
+}
+
+void OOScene2D::buildScaler() {
+	bool linear = this->scaleFilter == SCALE_BILINEAR;
+	buildTaps(this->scaleTapsX, this->width, this->displayWidth, linear);
+	buildTaps(this->scaleTapsY, this->height, this->displayHeight, linear);
+	this->scaleLine.resize(this->displayWidth);
+	this->scaleSource.resize(this->width);
+	this->scaleRows[0].resize(this->displayWidth);
+	this->scaleRows[1].resize(this->displayWidth);
+}
+
+void OOScene2D::SetScaleFilter(OOScaleFilter filter) {
+	// The render thread scales while presenting
+	this->waitRenderIdle();
+
+	this->scaleFilter = filter;
+	this->buildScaler();
+
+	// Every frame buffer was scaled the old way
+	for (auto& stale : this->staleRows) {
+		std::fill(stale.begin(), stale.end(), 1);
+	}
+}
+
+const uint32_t *OOScene2D::scaleRow(const OORenderTarget& source, int row, const uint32_t *keep) {
+	for (int i = 0; i < 2; i++) {
+		if (this->scaleRowIndex[i] == row) {
+			return this->scaleRows[i].data();
+		}
+	}
+
+	// Replace the row that isn't about to be mixed with this one, otherwise the one further up
+	int slot = this->scaleRowIndex[0] <= this->scaleRowIndex[1] ? 0 : 1;
+	if (keep != nullptr) {
+		slot = this->scaleRows[0].data() == keep ? 1 : 0;
+	}
+
+	const uint32_t *src = widenRow(source, row, this->scaleSource);
+	uint32_t *out = this->scaleRows[slot].data();
+	int factor = this->displayWidth / this->width;
+
+	if (this->scaleFilter == SCALE_BILINEAR) {
+		lerpRow(out, src, this->scaleTapsX.data(), this->displayWidth);
+	}
+	else if (factor * this->width == this->displayWidth) {
+		repeatRow(out, src, factor, this->width);
+	}
+	else {
+		pickRow(out, src, this->scaleTapsX.data(), this->displayWidth);
+	}
+
+	this->scaleRowIndex[slot] = row;
+	return out;
+}
+
+void OOScene2D::upscaleRows(uint32_t *dst, const std::vector<uint8_t>& stale) {
+	OORenderTarget source = this->targetFor(this->activeFrameBufferIdx);
+
+	// Rows of the last frame
+	this->scaleRowIndex[0] = -1;
+	this->scaleRowIndex[1] = -1;
+
+	for (int y = 0; y < this->displayHeight; y++) {
+		const OOScaleTap& tap = this->scaleTapsY[y];
+		if (!stale[tap.src] && !stale[tap.next]) {
+			continue;
+		}
+
+		// Every input row is scaled across once, display rows only mix two of them
+		const uint32_t *line = this->scaleRow(source, tap.src, nullptr);
+		if (tap.weight != 0) {
+			lerpSpan(this->scaleLine.data(), line, this->scaleRow(source, tap.next, line), tap.weight, this->displayWidth);
+			line = this->scaleLine.data();
+		}
+
+		streamSpan(dst + (static_cast<size_t>(y) * this->displayWidth), line, this->displayWidth);
+	}
+}
+
+void OOCommandList::Clear() {
+	this->commands.clear();
+	this->text.clear();
+	this->mappings.clear();
+}
+
+OORenderTarget OOScene2D::targetFor(int bufferIndex) {
+	if (!this->backBuffer.empty()) {
+		return { this->backBuffer.data(), this->width, this->height, this->width, this->renderFormat, { 0, 0, this->width, this->height } };
+	}
+
+	return { this->frameBuffers[bufferIndex], this->width, this->height, this->width, PIXEL_A8R8G8B8, { 0, 0, this->width, this->height } };
+}
+
+void OOScene2D::submit(const OODrawCommand& cmd, const char *text, const OOSpriteMapping *mapping) {
+	if (this->frameStats && !this->drawStarted) {
+		this->firstDraw = std::chrono::steady_clock::now();
+		this->drawStarted = true;
+	}
+
+	if (!this->commandBuffering) {
+		// Immediate mode, rasterize right away
+		this->execute(this->targetFor(this->activeFrameBufferIdx), cmd, text, mapping);
+	}
+	else {
+		this->recordList.commands.push_back(cmd);
+
+		// Strings are copied into the list, the caller's may be gone by the time the frame is drawn
+		if (text != nullptr) {
+			this->recordList.commands.back().text = this->recordList.text.size();
+			this->recordList.text.insert(this->recordList.text.end(), text, text + strlen(text) + 1);
+		}
+
+		if (mapping != nullptr) {
+			this->recordList.commands.back().text = this->recordList.mappings.size();
+			this->recordList.mappings.push_back(*mapping);
+		}
+	}
+
+	if (this->frameStats) {
+		this->lastDraw = std::chrono::steady_clock::now();
+	}
+}
+
+void OOScene2D::execute(const OORenderTarget& target, const OODrawCommand& cmd, const char *text, const OOSpriteMapping *mapping) {
+	switch (cmd.type) {
+	case DRAW_FILL:
+		this->fillRect(target, cmd.x, cmd.y, cmd.w, cmd.h, cmd.color);
+		break;
+
+	case DRAW_PIXEL:
+		this->fillRect(target, cmd.x, cmd.y, 1, 1, cmd.color);
+		break;
+
+	case DRAW_SPRITE:
+		this->blitSprite(target, this->sprites[cmd.index], cmd.x, cmd.y, cmd.left, cmd.top, cmd.w, cmd.h);
+		break;
+
+	case DRAW_SPRITE_TRANSFORMED:
+		this->blitTransformed(target, this->sprites[cmd.index], cmd.x, cmd.y, cmd.w, cmd.h, *mapping);
+		break;
+
+	case DRAW_TEXT: {
+		// Glyphs are only known once laid out, so text carries its clip rectangle along
+		OORenderTarget clipped = target;
+		clipped.clip = intersectRect(target.clip, { cmd.left, cmd.top, cmd.w, cmd.h });
+		this->drawText(clipped, text, this->fonts[cmd.index], cmd.x, cmd.y, cmd.color);
+		break;
+	}
+	}
+}
+
+void OOScene2D::executeList(const OORenderTarget& target, const OOCommandList& list) {
+	if (!this->workers.empty()) {
+		this->executeTiled(target, list);
+		return;
+	}
+
+	for (const OODrawCommand& cmd : list.commands) {
+		const char *text = (cmd.type == DRAW_TEXT) ? list.text.data() + cmd.text : nullptr;
+		const OOSpriteMapping *mapping = (cmd.type == DRAW_SPRITE_TRANSFORMED) ? list.mappings.data() + cmd.text : nullptr;
+		this->execute(target, cmd, text, mapping);
+	}
+}
+
+void OOScene2D::executeTiled(const OORenderTarget& target, const OOCommandList& list) {
+	this->binList(target, list);
+
+	this->tileList = &list;
+	this->tileTarget = target;
+	this->nextTile = 0;
+
+	{
+		std::lock_guard<std::mutex> lock(this->workerMutex);
+		this->workersRunning = this->workers.size();
+		this->workerGeneration++;
+	}
+
+	this->workerCond.notify_all();
+
+	// Help out with the tiles instead of sitting idle
+	this->renderTiles();
+
+	std::unique_lock<std::mutex> lock(this->workerMutex);
+	this->workerCond.wait(lock, [this] { return this->workersRunning == 0; });
+}
+
+void OOScene2D::binList(const OORenderTarget& target, const OOCommandList& list) {
+	this->tileColumns = (target.width + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+	this->tileRows = (target.height + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+	this->tileBins.resize(this->tileColumns * this->tileRows);
+	for (auto& bin : this->tileBins) {
+		bin.clear();
+	}
+
+	this->tileQuads.clear();
+	this->tileTexts.resize(list.commands.size());
+
+	// All text of the list is laid out in one batch, so none of its glyphs get evicted before the tiles are drawn
+	std::lock_guard<std::mutex> lock(this->glyphMutex);
+	this->glyphCache.BeginBatch();
+
+	for (size_t i = 0; i < list.commands.size(); i++) {
+		const OODrawCommand& cmd = list.commands[i];
+		int x0 = cmd.x;
+		int y0 = cmd.y;
+		int x1 = cmd.x + cmd.w;
+		int y1 = cmd.y + cmd.h;
+
+		if (cmd.type == DRAW_TEXT) {
+			OOTextRun& run = this->tileTexts[i];
+			run.firstQuad = this->tileQuads.size();
+			run.atlas = this->layoutText(list.text.data() + cmd.text, this->fonts[cmd.index], cmd.x, cmd.y, this->tileQuads);
+			run.quadCount = this->tileQuads.size() - run.firstQuad;
+
+			if (run.quadCount == 0) {
+				continue;
+			}
+
+			// Bin the string by the exact bounds of its glyphs
+			const OOGlyphQuad *quad = this->tileQuads.data() + run.firstQuad;
+			x0 = quad->dstX;
+			y0 = quad->dstY;
+			x1 = quad->dstX + quad->w;
+			y1 = quad->dstY + quad->h;
+			for (size_t q = 1; q < run.quadCount; q++) {
+				quad++;
+				x0 = std::min(x0, quad->dstX);
+				y0 = std::min(y0, quad->dstY);
+				x1 = std::max(x1, quad->dstX + quad->w);
+				y1 = std::max(y1, quad->dstY + quad->h);
+			}
+
+			x0 = std::max(x0, cmd.left);
+			y0 = std::max(y0, cmd.top);
+			x1 = std::min(x1, cmd.left + cmd.w);
+			y1 = std::min(y1, cmd.top + cmd.h);
+		}
+
+		x0 = std::max(x0, target.clip.x);
+		y0 = std::max(y0, target.clip.y);
+		x1 = std::min(x1, target.clip.x + target.clip.w);
+		y1 = std::min(y1, target.clip.y + target.clip.h);
+
+		if (x0 >= x1 || y0 >= y1) {
+			continue;
+		}
+
+		// Commands are visited in order, so every bin stays in draw order
+		for (int ty = y0 / RENDER_TILE_SIZE; ty <= (y1 - 1) / RENDER_TILE_SIZE; ty++) {
+			for (int tx = x0 / RENDER_TILE_SIZE; tx <= (x1 - 1) / RENDER_TILE_SIZE; tx++) {
+				this->tileBins[(ty * this->tileColumns) + tx].push_back(i);
+			}
+		}
+	}
+}
+
+void OOScene2D::renderTiles() {
+	// Grab tiles until there are none left, busy tiles naturally balance out with empty ones
+	for (;;) {
+		int tile = this->nextTile.fetch_add(1);
+		if (tile >= static_cast<int>(this->tileBins.size())) {
+			break;
+		}
+
+		this->renderTile(tile);
+	}
+}
+
+void OOScene2D::renderTile(int tile) {
+	const std::vector<uint32_t>& bin = this->tileBins[tile];
+	if (bin.empty()) {
+		return;
+	}
+
+	// Same frame buffer, but clipped to the tile, so no two threads ever write the same pixel
+	OORenderTarget target = this->tileTarget;
+	int x0 = std::max((tile % this->tileColumns) * RENDER_TILE_SIZE, target.clip.x);
+	int y0 = std::max((tile / this->tileColumns) * RENDER_TILE_SIZE, target.clip.y);
+	int x1 = std::min((tile % this->tileColumns + 1) * RENDER_TILE_SIZE, target.clip.x + target.clip.w);
+	int y1 = std::min((tile / this->tileColumns + 1) * RENDER_TILE_SIZE, target.clip.y + target.clip.h);
+	target.clip = { x0, y0, x1 - x0, y1 - y0 };
+
+	for (uint32_t i : bin) {
+		const OODrawCommand& cmd = this->tileList->commands[i];
+
+		if (cmd.type == DRAW_TEXT) {
+			const OOTextRun& run = this->tileTexts[i];
+			OORenderTarget clipped = target;
+			clipped.clip = intersectRect(target.clip, { cmd.left, cmd.top, cmd.w, cmd.h });
+			this->blitGlyphs(clipped, *run.atlas, this->tileQuads.data() + run.firstQuad, run.quadCount, cmd.color);
+		}
+		else {
+			const OOSpriteMapping *mapping = (cmd.type == DRAW_SPRITE_TRANSFORMED) ? this->tileList->mappings.data() + cmd.text : nullptr;
+			this->execute(target, cmd, nullptr, mapping);
+		}
+	}
+}
+
+void OOScene2D::workerMain(unsigned generation) {
+	std::unique_lock<std::mutex> lock(this->workerMutex);
+
+	for (;;) {
+		this->workerCond.wait(lock, [&] { return this->workerGeneration != generation || this->workerStop; });
+		if (this->workerStop) {
+			break;
+		}
+
+		generation = this->workerGeneration;
+		lock.unlock();
+
+		this->renderTiles();
+
+		lock.lock();
+		if (--this->workersRunning == 0) {
+			this->workerCond.notify_all();
+		}
+	}
+}
+
+void OOScene2D::stopWorkers() {
+	if (this->workers.empty()) {
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(this->workerMutex);
+		this->workerStop = true;
+	}
+
+	this->workerCond.notify_all();
+	for (auto& worker : this->workers) {
+		worker.join();
+	}
+
+	this->workers.clear();
+	this->workerStop = false;
+}
+
+void OOScene2D::SetRenderWorkers(int count) {
+	// Only command lists are tiled, so this does nothing unless command buffering is on.
+	// The render thread must not be in the middle of a list while the workers change
+	this->waitRenderIdle();
+	this->stopWorkers();
+
+	// The thread executing the list renders tiles too, so it counts as one of them.
+	// Workers are handed the current generation, a list may be dispatched before they get to run
+	for (int i = 1; i < count; i++) {
+		this->workers.emplace_back(&OOScene2D::workerMain, this, this->workerGeneration);
+	}
+}
+
+void OOScene2D::renderThreadMain() {
+	std::unique_lock<std::mutex> lock(this->renderMutex);
+
+	for (;;) {
+		this->renderCond.wait(lock, [this] { return this->renderBusy || this->renderStop; });
+		if (!this->renderBusy) {
+			break;
+		}
+
+		lock.unlock();
+
+		// Draw the frame once the display is done with its buffer, then present it just like Commit does in immediate mode.
+		// With a back buffer only the copy has to wait for the display.
+		bool cached = !this->backBuffer.empty();
+		if (!cached) {
+			this->acquireBuffer(this->renderBufferIdx);
+		}
+
+		this->executeList(this->targetFor(this->renderBufferIdx), this->renderList);
+
+		if (cached) {
+			this->acquireBuffer(this->renderBufferIdx);
+			this->resolveBackBuffer(this->renderBufferIdx, this->renderList.rows);
+		}
+
+		this->present(this->renderBufferIdx, this->renderFrameID);
+
+		lock.lock();
+		this->renderBusy = false;
+		this->renderCond.notify_all();
+	}
+}
+
+void OOScene2D::waitRenderIdle() {
+	std::unique_lock<std::mutex> lock(this->renderMutex);
+	this->renderCond.wait(lock, [this] { return !this->renderBusy; });
+}
+
+void OOScene2D::flushCommands() {
+	if (!this->commandBuffering) {
+		return;
+	}
+
+	// Let the render thread finish the previous frame, then draw what's been recorded so far right here
+	this->waitRenderIdle();
+	this->acquireBuffer(this->activeFrameBufferIdx);
+	this->executeList(this->targetFor(this->activeFrameBufferIdx), this->recordList);
+	this->recordList.Clear();
+}
+
+void OOScene2D::SetCommandBuffering(bool enable) {
+	if (enable == this->commandBuffering) {
+		return;
+	}
+
+	if (enable) {
+		this->renderBusy = false;
+		this->renderStop = false;
+		this->commandBuffering = true;
+		this->renderThread = std::thread(&OOScene2D::renderThreadMain, this);
+		return;
+	}
+
+	// Draw whatever is pending, so nothing recorded gets lost
+	this->flushCommands();
+
+	{
+		std::lock_guard<std::mutex> lock(this->renderMutex);
+		this->renderStop = true;
+	}
+
+	this->renderCond.notify_all();
+	this->renderThread.join();
+	this->commandBuffering = false;
+}
+
+int OOScene2D::InitPNG(const std::string& fname) {
+	std::string key = OOAssetCache::FileKey(fname);
+	int cached = this->spriteAssets.Acquire(key);
+	if (cached >= 0) {
+		// may have been requested with InitPNGAsync
+		this->WaitPNG(cached);
+		return cached;
+	}
+
+	// The sprite vector may grow, the render thread must not be looking at it
+	this->flushCommands();
+	this->sprites.emplace_back(fname.c_str());
+	this->packSprite(this->sprites.size() - 1);
+	return this->spriteAssets.Insert(key, this->sprites.size() - 1);
+}
+
+int OOScene2D::InitPNG(size_t bufSize, unsigned char *pngBuf) {
+	if (pngBuf == nullptr || bufSize == 0) {
+		OOCRASHMSG("PNG buffer is null.");
+	}
+
+	std::string key = OOAssetCache::ContentKey(pngBuf, bufSize);
+	int cached = this->spriteAssets.Acquire(key);
+	if (cached >= 0) {
+		return cached;
+	}
+
+	this->flushCommands();
+	this->sprites.emplace_back(bufSize, pngBuf);
+	this->packSprite(this->sprites.size() - 1);
+	return this->spriteAssets.Insert(key, this->sprites.size() - 1);
+}
+
+int OOScene2D::InitPNG(int w, int h, const Color *pixels) {
+	if (pixels == nullptr || w <= 0 || h <= 0) {
+		OOCRASHMSG("PNG pixels are null.");
+	}
+
+	this->flushCommands();
+	this->sprites.emplace_back(w, h, pixels);
+	this->packSprite(this->sprites.size() - 1);
+	return this->sprites.size() - 1;
+}
+
+int OOScene2D::InitPNGAsync(const std::string& fname) {
+	std::string key = OOAssetCache::FileKey(fname);
+	int cached = this->spriteAssets.Acquire(key);
+	if (cached >= 0) {
+		return cached;
+	}
+
+	// The handle is an empty sprite until the image is decoded. Queuing doesn't wait for the render thread,
+	// unless growing the sprites would move them while it reads them
+	if (this->sprites.size() == this->sprites.capacity()) {
+		this->flushCommands();
+	}
+
+	this->sprites.push_back(OOPNG());
+	this->sprites.back().loading = true;
+	int index = this->sprites.size() - 1;
+
+	if (this->loaders.empty()) {
+		this->loadStop = false;
+		for (int i = 0; i < PNG_LOAD_THREADS; i++) {
+			this->loaders.emplace_back(&OOScene2D::loaderMain, this);
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(this->loadMutex);
+		this->loadQueue.push_back({ index, fname, nullptr, { } });
+	}
+
+	this->loadsPending++;
+	this->loadCond.notify_one();
+	return this->spriteAssets.Insert(key, index);
+}
+
+bool OOScene2D::IsPNGReady(int index) {
+	if (index < 0 || index > this->sprites.size() - 1) {
+		OOCRASHMSG("PNG index out of range.");
+	}
+
+	this->publishLoads();
+	return !this->sprites[index].loading && !this->sprites[index].IsFreed();
+}
+
+bool OOScene2D::WaitPNG(int index) {
+	if (index < 0 || index > this->sprites.size() - 1) {
+		OOCRASHMSG("PNG index out of range.");
+	}
+
+	this->publishLoads();
+	while (this->sprites[index].loading) {
+		{
+			std::unique_lock<std::mutex> lock(this->loadMutex);
+			this->loadDoneCond.wait(lock, [this] { return !this->loadDone.empty(); });
+		}
+
+		this->publishLoads();
+	}
+
+	return !this->sprites[index].failed && !this->sprites[index].IsFreed();
+}
+
+void OOScene2D::WaitPNGs() {
+	this->publishLoads();
+	while (this->loadsPending > 0) {
+		{
+			std::unique_lock<std::mutex> lock(this->loadMutex);
+			this->loadDoneCond.wait(lock, [this] { return !this->loadDone.empty(); });
+		}
+
+		this->publishLoads();
+	}
+}
+
+void OOScene2D::loaderMain() {
+	for (;;) {
+		OOPNGLoad load;
+		{
+			std::unique_lock<std::mutex> lock(this->loadMutex);
+			this->loadCond.wait(lock, [this] { return this->loadStop || !this->loadQueue.empty(); });
+
+			if (this->loadStop) {
+				return;
+			}
+
+			load = std::move(this->loadQueue.front());
+			this->loadQueue.pop_front();
+		}
+
+		// Decode, convert and classify here, the game thread only has to pack it. No sprite if that fails
+		load.png.reset(new OOPNG());
+		if (!load.png->load(load.path.c_str(), load.messages)) {
+			load.png.reset();
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(this->loadMutex);
+			this->loadDone.push_back(std::move(load));
+		}
+
+		this->loadDoneCond.notify_all();
+	}
+}
+
+void OOScene2D::stopLoaders() {
+	{
+		std::lock_guard<std::mutex> lock(this->loadMutex);
+		this->loadStop = true;
+	}
+
+	this->loadCond.notify_all();
+	for (std::thread& loader : this->loaders) {
+		loader.join();
+	}
+
+	this->loaders.clear();
+	this->loadQueue.clear();
+	this->loadDone.clear();
+	this->loadsPending = 0;
+}
+
+void OOScene2D::publishLoads() {
+	std::vector<OOPNGLoad> done;
+	{
+		std::lock_guard<std::mutex> lock(this->loadMutex);
+		done.swap(this->loadDone);
+	}
+
+	// No flush needed: the render thread never looks at a loading sprite, and packing only writes unused page space
+	for (OOPNGLoad& load : done) {
+		this->loadsPending--;
+
+		// The loaders can't share the log with the game thread, they leave it to us
+		for (const std::string& message : load.messages) {
+			DEBUGLOG << message;
+		}
+
+		OOPNG& png = this->sprites[load.index];
+		if (!png.loading) {
+			// freed before it finished
+			continue;
+		}
+
+		if (load.png == nullptr) {
+			png.loading = false;
+			png.failed = true;
+			continue;
+		}
+
+		png = std::move(*load.png);
+		this->packSprite(load.index);
+	}
+}
+
+void OOScene2D::DrawPNG(int x, int y, int index) {
+	if (index < 0 || index > this->sprites.size() - 1) {
+		OOCRASHMSG("PNG index out of range.");
+	}
+
+	if (this->sprites[index].loading || this->sprites[index].failed) {
+		return;
+	}
+
+	if (this->sprites[index].IsFreed()) {
+		OOCRASHMSG("PNG is freed.");
+	}
+
+	SpriteDim dim;
+	this->sprites[index].GetInfo(dim);
+	this->DrawPNGPart(x, y, 0, 0, dim.w, dim.h, index);
+}
+
+void OOScene2D::DrawPNGPart(int x, int y, int left, int top, int width, int height, int index) {
+	if (index < 0 || index > this->sprites.size() - 1) {
+		OOCRASHMSG("PNG index out of range.");
+	}
+
+	if (this->sprites[index].loading || this->sprites[index].failed) {
+		return;
+	}
+
+	if (this->sprites[index].IsFreed()) {
+		OOCRASHMSG("PNG is freed.");
+	}
+
+	if (!this->sprites[index].clipPart(x, y, left, top, width, height)) {
+		return;
+	}
+
+	OORect rect = intersectRect({ x, y, width, height }, this->clip);
+	if (rect.w == 0 || rect.h == 0) {
+		return;
+	}
+
+	// Pre-clipped, the blit only ever sees visible pixels
+	this->markDirty(rect.x, rect.y, rect.x + rect.w, rect.y + rect.h);
+	this->submit({ DRAW_SPRITE, rect.x, rect.y, rect.w, rect.h, left + (rect.x - x), top + (rect.y - y), index, COLOR_ZERO, 0 });
+}
+
+void OOScene2D::DrawPNGTransformed(int x, int y, int index, const OOSpriteTransform& transform) {
+	if (index < 0 || index > this->sprites.size() - 1) {
+		OOCRASHMSG("PNG index out of range.");
+	}
+
+	if (this->sprites[index].loading || this->sprites[index].failed) {
+		return;
+	}
+
+	if (this->sprites[index].IsFreed()) {
+		OOCRASHMSG("PNG is freed.");
+	}
+
+	const OOPNG& png = this->sprites[index];
+	double scaleX = transform.flipX ? -transform.scaleX : transform.scaleX;
+	double scaleY = transform.flipY ? -transform.scaleY : transform.scaleY;
+
+	// Not transformed at all, the plain blitter copies opaque runs instead of blending them
+	if (scaleX == 1.0 && scaleY == 1.0 && transform.rotation == 0.0f) {
+		this->DrawPNGPart(x - transform.originX, y - transform.originY, 0, 0, png.width, png.height, index);
+		return;
+	}
+
+	// Steps past this don't fit the 16.16 math
+	if (fabs(scaleX) < (1.0 / 4096) || fabs(scaleY) < (1.0 / 4096)) {
+		return;
+	}
+
+	if (png.width > INT16_MAX || png.height > INT16_MAX) {
+		DEBUGLOG << "[DEBUG] [SCENE2D] Sprite " << index << " is too big to be transformed.";
+		return;
+	}
+
+	double c = cos(transform.rotation);
+	double s = sin(transform.rotation);
+
+	// Destination bounds, from the transformed corners of the sprite
+	double minX = INFINITY;
+	double minY = INFINITY;
+	double maxX = -INFINITY;
+	double maxY = -INFINITY;
+	for (int corner = 0; corner < 4; corner++) {
+		double lx = (((corner & 1) ? png.width : 0) - transform.originX) * scaleX;
+		double ly = (((corner & 2) ? png.height : 0) - transform.originY) * scaleY;
+		double dx = x + (c * lx) - (s * ly);
+		double dy = y + (s * lx) + (c * ly);
+
+		minX = std::min(minX, dx);
+		minY = std::min(minY, dy);
+		maxX = std::max(maxX, dx);
+		maxY = std::max(maxY, dy);
+	}
+
+	int x0 = static_cast<int>(floor(std::max(minX, static_cast<double>(this->clip.x))));
+	int y0 = static_cast<int>(floor(std::max(minY, static_cast<double>(this->clip.y))));
+	int x1 = static_cast<int>(ceil(std::min(maxX, static_cast<double>(this->clip.x + this->clip.w))));
+	int y1 = static_cast<int>(ceil(std::min(maxY, static_cast<double>(this->clip.y + this->clip.h))));
+
+	OORect rect = intersectRect({ x0, y0, x1 - x0, y1 - y0 }, this->clip);
+	if (rect.w == 0 || rect.h == 0) {
+		return;
+	}
+
+	// Map destination pixel centers back into the sprite, the blitter only adds steps from here
+	double dudx = c / scaleX;
+	double dudy = s / scaleX;
+	double dvdx = -s / scaleY;
+	double dvdy = c / scaleY;
+	double ox = rect.x + 0.5 - x;
+	double oy = rect.y + 0.5 - y;
+
+	OOSpriteMapping mapping;
+	mapping.u0 = llround((transform.originX + (dudx * ox) + (dudy * oy)) * 65536.0);
+	mapping.v0 = llround((transform.originY + (dvdx * ox) + (dvdy * oy)) * 65536.0);
+	mapping.dudx = static_cast<int32_t>(llround(dudx * 65536.0));
+	mapping.dudy = static_cast<int32_t>(llround(dudy * 65536.0));
+	mapping.dvdx = static_cast<int32_t>(llround(dvdx * 65536.0));
+	mapping.dvdy = static_cast<int32_t>(llround(dvdy * 65536.0));
+
+	// Whole number scales repeat every texel, the rounded dudx (1/3 isn't exact) can't tell
+	double repeat = fabs(scaleX);
+	bool axisAligned = mapping.dudy == 0 && mapping.dvdx == 0;
+	mapping.repeat = (axisAligned && repeat == round(repeat) && repeat <= INT16_MAX) ? static_cast<int32_t>(repeat) : 0;
+
+	this->markDirty(rect.x, rect.y, rect.x + rect.w, rect.y + rect.h);
+	this->submit({ DRAW_SPRITE_TRANSFORMED, rect.x, rect.y, rect.w, rect.h, 0, 0, index, COLOR_ZERO, 0 }, nullptr, &mapping);
+}
+
+void OOScene2D::DrawPNGBatch(const int *indices, const int *xs, const int *ys, size_t count) {
+	if (count == 0) {
+		return;
+	}
+
+	this->batchW.resize(count);
+	this->batchH.resize(count);
+	this->batchRects.resize(count);
+	this->batchOrder.clear();
+
+	// Validate every handle once, and gather the sprite sizes for the clip pass
+	for (size_t i = 0; i < count; i++) {
+		int index = indices[i];
+		if (index < 0 || index > this->sprites.size() - 1) {
+			OOCRASHMSG("PNG index out of range.");
+		}
+
+		// not loaded (yet), sized so it clips away
+		const OOPNG& png = this->sprites[index];
+		if (png.loading || png.failed) {
+			this->batchW[i] = 0;
+			this->batchH[i] = 0;
+			continue;
+		}
+
+		if (png.pixels == nullptr) {
+			OOCRASHMSG("PNG is freed.");
+		}
+
+		this->batchW[i] = png.width;
+		this->batchH[i] = png.height;
+	}
+
+	clipRects(xs, ys, this->batchW.data(), this->batchH.data(), count, this->clip, this->batchRects.data());
+
+	// Every visible item is dirty on its own, a union of scattered items would be most of the screen
+	for (size_t i = 0; i < count; i++) {
+		const OORect& rect = this->batchRects[i];
+		if (rect.w <= 0 || rect.h <= 0) {
+			continue;
+		}
+
+		this->batchOrder.push_back(static_cast<uint32_t>(i));
+		this->markDirty(rect.x, rect.y, rect.x + rect.w, rect.y + rect.h);
+	}
+
+	if (this->batchOrder.empty()) {
+		return;
+	}
+
+	// Group by page, then by sprite, so the source pixels stay in cache.
+	// Stable, copies of one sprite keep their order. Different sprites that overlap may not, batch things that don't care (particles, tiles)
+	std::stable_sort(this->batchOrder.begin(), this->batchOrder.end(), [this, indices](uint32_t a, uint32_t b) {
+		int pageA = this->sprites[indices[a]].page;
+		int pageB = this->sprites[indices[b]].page;
+		return pageA != pageB ? pageA < pageB : indices[a] < indices[b];
+	});
+
+	// Already clipped, so the blits only ever see visible pixels
+	for (uint32_t i : this->batchOrder) {
+		const OORect& rect = this->batchRects[i];
+		this->submit({ DRAW_SPRITE, rect.x, rect.y, rect.w, rect.h, rect.x - xs[i], rect.y - ys[i], indices[i], COLOR_ZERO, 0 });
+	}
+}
+
+void OOScene2D::FreePNG(int index) {
+	if (index < 0 || index > this->sprites.size() - 1) {
+		OOCRASHMSG("PNG index out of range.");
+	}
+
+	// Shared with another load of the same image
+	if (!this->spriteAssets.Release(index)) {
+		return;
+	}
+
+	// Still decoding, the result gets thrown away when it comes in
+	if (this->sprites[index].loading) {
+		this->sprites[index].loading = false;
+		return;
+	}
+
+	// Never decoded, there's nothing to give back
+	if (this->sprites[index].failed) {
+		this->sprites[index].failed = false;
+		return;
+	}
+
+	if (this->sprites[index].IsFreed()) {
+		OOCRASHMSG("PNG is freed.");
+	}
+
+	// Recorded draws may still use this sprite
+	this->flushCommands();
+	this->unpackSprite(index);
+	this->sprites[index].release();
+}
+
+bool OOScene2D::packRect(OOSpritePage& page, int w, int h, int& x, int& y) {
+	// Bottom-left skyline packing: put the rectangle wherever it rests lowest
+	int bestIndex = -1;
+	int bestY = 0;
+
+	for (size_t i = 0; i < page.skyline.size(); i++) {
+		int nodeX = page.skyline[i].x;
+		if (nodeX + w > SPRITE_PAGE_SIZE) {
+			break;
+		}
+
+		// It rests on the highest node it spans
+		int nodeY = 0;
+		int remaining = w;
+		for (size_t j = i; remaining > 0; j++) {
+			nodeY = std::max(nodeY, page.skyline[j].y);
+			remaining -= page.skyline[j].width;
+		}
+
+		if (nodeY + h <= SPRITE_PAGE_SIZE && (bestIndex < 0 || nodeY < bestY)) {
+			bestIndex = i;
+			bestY = nodeY;
+		}
+	}
+
+	if (bestIndex < 0) {
+		return false;
+	}
+
+	x = page.skyline[bestIndex].x;
+	y = bestY;
+
+	// Raise the skyline over the rectangle, and cut it out of the nodes it covers
+	page.skyline.insert(page.skyline.begin() + bestIndex, { x, y + h, w });
+
+	for (size_t i = bestIndex + 1; i < page.skyline.size();) {
+		OOSkylineNode& node = page.skyline[i];
+		int covered = (x + w) - node.x;
+
+		if (covered <= 0) {
+			break;
+		}
+
+		if (covered >= node.width) {
+			page.skyline.erase(page.skyline.begin() + i);
+			continue;
+		}
+
+		node.x += covered;
+		node.width -= covered;
+		break;
+	}
 
-void OOScene2D::SubmitFlip(int frameID) {
-	sceVideoOutSubmitFlip(this->video, this->activeFrameBufferIdx, ORBIS_VIDEO_OUT_FLIP_VSYNC, frameID);
+	// Neighbours at the same height are one node
+	for (size_t i = 0; i + 1 < page.skyline.size();) {
+		if (page.skyline[i].y == page.skyline[i + 1].y) {
+			page.skyline[i].width += page.skyline[i + 1].width;
+			page.skyline.erase(page.skyline.begin() + i + 1);
+		}
+		else {
+			i++;
+		}
+	}
+
+	return true;
 }
 
-void OOScene2D::FrameWait(int frameID) {
-	OrbisKernelEvent evt;
-	int count;
+void OOScene2D::packSprite(int index) {
+	OOPNG& png = this->sprites[index];
 
-	// If the video handle is not initialized, bail out. This is mostly a failsafe, this should never happen.
-	if (this->video == 0) {
+	// Big sprites gain nothing from sharing a page
+	if (png.width > SPRITE_PAGE_MAX || png.height > SPRITE_PAGE_MAX) {
 		return;
 	}
 
-	for (;;) {
-		OrbisVideoOutFlipStatus flipStatus;
+	int x = 0;
+	int y = 0;
+	int pageIndex = -1;
+	int unusedPage = -1;
 
-		// Get the flip status and check the arg for the given frame ID
-		sceVideoOutGetFlipStatus(video, &flipStatus);
+	for (size_t i = 0; i < this->spritePages.size(); i++) {
+		if (this->spritePages[i].pixels.empty()) {
+			unusedPage = i;
+			continue;
+		}
 
-		if (flipStatus.flipArg == frameID) {
+		if (this->packRect(this->spritePages[i], png.width, png.height, x, y)) {
+			pageIndex = i;
 			break;
 		}
+	}
 
-		// Wait on next flip event
-		if (sceKernelWaitEqueue(this->flipQueue, &evt, 1, &count, 0) != ORBIS_OK) {
-			break;
+	// Every page is full, start a new one (or bring back one that was emptied)
+	if (pageIndex < 0) {
+		if (unusedPage < 0) {
+			this->spritePages.push_back({ });
+			unusedPage = this->spritePages.size() - 1;
 		}
+
+		OOSpritePage& page = this->spritePages[unusedPage];
+		page.pixels.assign(SPRITE_PAGE_SIZE * SPRITE_PAGE_SIZE, 0);
+		page.skyline.assign(1, { 0, 0, SPRITE_PAGE_SIZE });
+		page.sprites.clear();
+		page.used = 0;
+
+		pageIndex = unusedPage;
+		this->packRect(page, png.width, png.height, x, y);
 	}
-}
 
-void OOScene2D::FrameBufferSwap() {
-	// Swap the frame buffer for some perf
-	this->activeFrameBufferIdx = (this->activeFrameBufferIdx + 1) % 2;
-}
+	OOSpritePage& page = this->spritePages[pageIndex];
+	uint32_t *dst = page.pixels.data() + (y * SPRITE_PAGE_SIZE) + x;
 
-void OOScene2D::FrameBufferClear() {
-	// Clear the screen with a black frame buffer
-	this->FrameBufferFill(COLOR_BLACK);
-}
+	for (int row = 0; row < png.height; row++) {
+		memcpy(dst + (row * SPRITE_PAGE_SIZE), png.img + (row * png.width), png.width * sizeof(uint32_t));
+	}
 
-int OOScene2D::InitPNG(const std::string& fname) {
-	this->sprites.emplace_back(fname.c_str());
-	return this->sprites.size() - 1;
+	// The page has the pixels now, drop the sprite's own buffer
+	stbi_image_free(png.img);
+	png.img = nullptr;
+	png.pixels = dst;
+	png.pitch = SPRITE_PAGE_SIZE;
+	png.page = pageIndex;
+	png.pageX = x;
+	png.pageY = y;
+
+	page.sprites.push_back(index);
+	page.used += png.width * png.height;
 }
 
-int OOScene2D::InitPNG(size_t bufSize, unsigned char *pngBuf) {
-	if (pngBuf == nullptr || bufSize == 0) {
-		OOCRASHMSG("PNG buffer is null.");
+void OOScene2D::unpackSprite(int index) {
+	OOPNG& png = this->sprites[index];
+	if (png.page < 0) {
+		return;
 	}
 
-	this->sprites.emplace_back(bufSize, pngBuf);
-	return this->sprites.size() - 1;
-}
+	int pageIndex = png.page;
+	OOSpritePage& page = this->spritePages[pageIndex];
+	page.sprites.erase(std::find(page.sprites.begin(), page.sprites.end(), index));
+	page.used -= png.width * png.height;
 
-void OOScene2D::DrawPNG(int x, int y, int index) {
-	if (index < 0 || index > this->sprites.size() - 1) {
-		OOCRASHMSG("PNG index out of range.");
+	// Nothing left, give the memory back
+	if (page.sprites.empty()) {
+		std::vector<uint32_t>().swap(page.pixels);
+		page.skyline.clear();
+		return;
 	}
 
-	if (this->sprites[index].IsFreed()) {
-		OOCRASHMSG("PNG is freed.");
+	// The skyline never reclaims freed space, so repack once less than half of what's below it is still in use
+	size_t packed = 0;
+	for (const OOSkylineNode& node : page.skyline) {
+		packed += static_cast<size_t>(node.y) * node.width;
 	}
 
-	this->sprites[index].Draw(*this, x, y);
+	if (page.used * 2 < packed) {
+		this->compactPage(pageIndex);
+	}
 }
 
-void OOScene2D::DrawPNGPart(int x, int y, int left, int top, int width, int height, int index) {
-	if (index < 0 || index > this->sprites.size() - 1) {
-		OOCRASHMSG("PNG index out of range.");
-	}
+void OOScene2D::compactPage(int pageIndex) {
+	OOSpritePage& page = this->spritePages[pageIndex];
 
-	if (this->sprites[index].IsFreed()) {
-		OOCRASHMSG("PNG is freed.");
-	}
+	// Tallest first packs the tightest
+	std::vector<int> order = page.sprites;
+	std::sort(order.begin(), order.end(), [this](int a, int b) { return this->sprites[a].height > this->sprites[b].height; });
 
-	this->sprites[index].DrawPart(*this, x, y, left, top, width, height);
-}
+	// Place everything on a fresh skyline first, the page stays as it is if it doesn't work out
+	OOSpritePage packed = { };
+	packed.skyline.assign(1, { 0, 0, SPRITE_PAGE_SIZE });
+	std::vector<std::pair<int, int>> spots;
 
-void OOScene2D::FreePNG(int index) {
-	if (index < 0 || index > this->sprites.size() - 1) {
-		OOCRASHMSG("PNG index out of range.");
+	for (int index : order) {
+		int x, y;
+		if (!this->packRect(packed, this->sprites[index].width, this->sprites[index].height, x, y)) {
+			return;
+		}
+
+		spots.push_back({ x, y });
 	}
 
-	if (this->sprites[index].IsFreed()) {
-		OOCRASHMSG("PNG is freed.");
+	packed.pixels.assign(SPRITE_PAGE_SIZE * SPRITE_PAGE_SIZE, 0);
+
+	for (size_t i = 0; i < order.size(); i++) {
+		OOPNG& png = this->sprites[order[i]];
+		uint32_t *dst = packed.pixels.data() + (spots[i].second * SPRITE_PAGE_SIZE) + spots[i].first;
+
+		for (int row = 0; row < png.height; row++) {
+			memcpy(dst + (row * SPRITE_PAGE_SIZE), png.pixels + (row * SPRITE_PAGE_SIZE), png.width * sizeof(uint32_t));
+		}
+
+		png.pixels = dst;
+		png.pageX = spots[i].first;
+		png.pageY = spots[i].second;
 	}
 
-	this->sprites[index].~OOPNG();
+	page.pixels.swap(packed.pixels);
+	page.skyline.swap(packed.skyline);
 }
 
 void OOScene2D::CalcSpriteDim(int sprite, SpriteDim& out) {
@@ -710,6 +4149,16 @@ void OOScene2D::CalcSpriteDim(int sprite, SpriteDim& out) {
 		OOCRASHMSG("PNG index out of range.");
 	}
 
+	// The size isn't known before it's decoded, and there is none if that failed
+	if (this->sprites[sprite].loading) {
+		this->WaitPNG(sprite);
+	}
+
+	if (this->sprites[sprite].failed) {
+		out = { };
+		return;
+	}
+
 	if (this->sprites[sprite].IsFreed()) {
 		OOCRASHMSG("PNG is freed.");
 	}
@@ -718,13 +4167,48 @@ void OOScene2D::CalcSpriteDim(int sprite, SpriteDim& out) {
 }
 
 void OOScene2D::Commit() {
-	// Submit the frame buffer
-	this->SubmitFlip(this->frameID);
-	this->FrameWait(this->frameID);
+	// Sprites that finished decoding show up from the next frame on
+	this->publishLoads();
+
+	if (this->frameStats) {
+		// A frame without draws still gets timed, from here
+		if (!this->drawStarted) {
+			this->firstDraw = this->lastDraw = std::chrono::steady_clock::now();
+		}
+
+		std::lock_guard<std::mutex> lock(this->statsMutex);
+		this->frameTimings.push_back({ this->frameID, this->firstDraw, this->lastDraw, { }, false, false });
+		this->drawStarted = false;
+	}
+
+	if (this->commandBuffering) {
+		// Wait for the render thread to flip the previous frame, then hand this one over
+		std::unique_lock<std::mutex> lock(this->renderMutex);
+		this->renderCond.wait(lock, [this] { return !this->renderBusy; });
+
+		std::swap(this->recordList, this->renderList);
+		this->renderBufferIdx = this->activeFrameBufferIdx;
+		this->renderFrameID = this->frameID;
+		this->renderBusy = true;
+
+		lock.unlock();
+		this->renderCond.notify_all();
+
+		// What's left in here is the frame that was just drawn
+		this->recordList.Clear();
+	}
+	else {
+		// Submit the frame buffer
+		this->resolveBackBuffer(this->activeFrameBufferIdx, this->recordList.rows);
+		this->present(this->activeFrameBufferIdx, this->frameID);
+	}
 
 	// Swap to the next buffer
 	this->FrameBufferSwap();
 	this->frameID++;
+
+	// Flips nobody waited for still have to be timed
+	this->observeFlips();
 }
 
 bool OOScene2D::initFont(FT_Face *face, const char *fontPath, int fontSize) {
@@ -764,15 +4248,36 @@ bool OOScene2D::initMemFont(FT_Face *face, size_t bufSize, unsigned char* fontBu
 }
 
 int OOScene2D::InitFont(const std::string& fname, int fontSize) {
+	std::string key = OOAssetCache::FileKey(fname) + "@" + std::to_string(fontSize);
+	int cached = this->fontAssets.Acquire(key);
+	if (cached >= 0) {
+		return cached;
+	}
+
+	this->flushCommands();
 	this->fonts.push_back({ });
-	this->initFont(&(this->fonts.back()), fname.c_str(), fontSize);
-	return this->fonts.size() - 1;
+	if (!this->initFont(&(this->fonts.back()), fname.c_str(), fontSize)) {
+		return this->fonts.size() - 1;
+	}
+
+	return this->fontAssets.Insert(key, this->fonts.size() - 1);
 }
 
 int OOScene2D::InitFont(size_t bufSize, unsigned char *fontBuf, int fontSize) {
+	// FreeType keeps reading the caller's buffer, so only the very same buffer can be shared
+	std::string key = OOAssetCache::BufferKey(fontBuf, bufSize) + "@" + std::to_string(fontSize);
+	int cached = this->fontAssets.Acquire(key);
+	if (cached >= 0) {
+		return cached;
+	}
+
+	this->flushCommands();
 	this->fonts.push_back({ });
-	this->initMemFont(&(this->fonts.back()), bufSize, fontBuf, fontSize);
-	return this->fonts.size() - 1;
+	if (!this->initMemFont(&(this->fonts.back()), bufSize, fontBuf, fontSize)) {
+		return this->fonts.size() - 1;
+	}
+
+	return this->fontAssets.Insert(key, this->fonts.size() - 1);
 }
 
 bool OOScene2D::FreeFont(int index) {
@@ -780,25 +4285,72 @@ bool OOScene2D::FreeFont(int index) {
 		OOCRASHMSG("Font index out of range");
 	}
 
+	// Shared with another load of the same font
+	if (!this->fontAssets.Release(index)) {
+		return true;
+	}
+
+	this->flushCommands();
+	this->glyphCache.Purge(this->fonts[index]);
 	FT_Done_Face(this->fonts[index]);
 	this->fonts[index] = { };
 
 	return true;
 }
 
+void OOScene2D::SetGlyphCacheSize(size_t bytes) {
+	std::lock_guard<std::mutex> lock(this->glyphMutex);
+	this->glyphCache.SetBudget(bytes);
+}
+
 void OOScene2D::FrameBufferFill(Color color) {
-	this->DrawRectangle(0, 0, this->width, this->height, color);
+	this->submit({ DRAW_FILL, 0, 0, this->width, this->height, 0, 0, 0, color, 0 });
+
+	this->markRows(0, this->height);
+
+	// A black buffer is a clean one, anything else has to be fully cleared next time
+	std::vector<OORect>& dirty = this->dirtyList();
+	dirty.clear();
+	if (encodeColor(color) != encodeColor(COLOR_BLACK)) {
+		dirty.push_back({ 0, 0, this->width, this->height });
+	}
 }
 
 void OOScene2D::DrawPixel(int x, int y, Color color) {
-	// Get pixel location based on pitch
-	int pixel = (y * this->width) + x;
+	if (x < this->clip.x || y < this->clip.y || x >= this->clip.x + this->clip.w || y >= this->clip.y + this->clip.h) {
+		return;
+	}
+
+	this->markDirty(x, y, x + 1, y + 1);
+	this->submit({ DRAW_PIXEL, x, y, 1, 1, 0, 0, 0, color, 0 });
+}
+
+void OOScene2D::PushClip(int x, int y, int w, int h) {
+	// Nested clips only ever shrink, so every primitive has a single rectangle to test against
+	this->clipStack.push_back(this->clip);
+	this->clip = intersectRect(this->clip, { x, y, std::max(w, 0), std::max(h, 0) });
+}
+
+void OOScene2D::PopClip() {
+	if (this->clipStack.empty()) {
+		OOCRASHMSG("PopClip without a PushClip.");
+	}
 
-	// Encode to 24-bit color
-	uint32_t encodedColor = 0x80000000 + (color.r << 16) + (color.g << 8) + color.b;
+	this->clip = this->clipStack.back();
+	this->clipStack.pop_back();
+}
+
+void *OOScene2D::AllocVideoMem(size_t size, size_t alignment) {
+	// Null when it doesn't fit, quietly: callers that poll largestFree and retry would flood the log
+	return this->videoAllocator.Allocate(size, alignment);
+}
+
+void OOScene2D::FreeVideoMem(void *ptr) {
+	this->videoAllocator.Free(ptr);
+}
 
-	// Draw to the frame buffer
-	((uint32_t *)this->frameBuffers[this->activeFrameBufferIdx])[pixel] = encodedColor;
+void OOScene2D::GetVideoMemStats(OOVideoMemStats& out) {
+	this->videoAllocator.GetStats(out);
 }
 
 bool OOScene2D::GetPixel(int x, int y, Color& color) {
@@ -807,11 +4359,12 @@ bool OOScene2D::GetPixel(int x, int y, Color& color) {
 		return false;
 	}
 
-	// Get pixel location based on pitch
-	int pixel = (y * this->width) + x;
+	// Recorded draws have to land in the frame buffer before we can read it
+	this->flushCommands();
 
-	// Get pixel.
-	uint32_t col = ((uint32_t *)this->frameBuffers[this->activeFrameBufferIdx])[pixel];
+	// Get pixel, from the back buffer if there is one.
+	uint32_t col;
+	readSpan(this->targetFor(this->activeFrameBufferIdx), x, y, &col, 1);
 
 	// Return color.
 	color.r = (col >> 16) & 0xFF;
@@ -822,13 +4375,278 @@ bool OOScene2D::GetPixel(int x, int y, Color& color) {
 	return true;
 }
 
+bool OOScene2D::DumpFrameBuffer(int index, const std::string& fname) {
+	if (index < 0 || index > this->frameBufferCount - 1) {
+		OOCRASHMSG("Frame buffer index out of range.");
+	}
+
+	// Recorded draws have to land in the frame buffer before we can save it
+	this->flushCommands();
+
+	FILE *file = fopen(fname.c_str(), "wb");
+	if (file == nullptr) {
+		DEBUGLOG << "[DEBUG] [SCENE2D] Failed to open " << fname << ": " << std::string(strerror(errno));
+		return false;
+	}
+
+	// The buffer being drawn is still in the back buffer, at the internal resolution
+	OORenderTarget target = this->targetFor(index);
+	if (index != this->activeFrameBufferIdx) {
+		target.pixels = this->frameBuffers[index];
+		target.format = PIXEL_A8R8G8B8;
+		target.width = target.pitch = this->displayWidth;
+		target.height = this->displayHeight;
+	}
+
+	// Binary PPM, a header and then plain RGB
+	fprintf(file, "P6\n%d %d\n255\n", target.width, target.height);
+
+	std::vector<uint32_t> pixels(target.width);
+	std::vector<uint8_t> row(target.width * 3);
+	bool ok = true;
+
+	for (int y = 0; y < target.height && ok; y++) {
+		readSpan(target, 0, y, pixels.data(), target.width);
+
+		for (int x = 0; x < target.width; x++) {
+			uint32_t col = pixels[x];
+			row[(x * 3) + 0] = (col >> 16) & 0xFF;
+			row[(x * 3) + 1] = (col >> 8) & 0xFF;
+			row[(x * 3) + 2] = col & 0xFF;
+		}
+
+		ok = fwrite(row.data(), 1, row.size(), file) == row.size();
+	}
+
+	fclose(file);
+
+	if (!ok) {
+		DEBUGLOG << "[DEBUG] [SCENE2D] Failed to write " << fname;
+	}
+
+	return ok;
+}
+
 void OOScene2D::DrawRectangle(int x, int y, int w, int h, Color color) {
-	int xPos, yPos;
+	OORect rect = intersectRect({ x, y, w, h }, this->clip);
+	if (rect.w == 0 || rect.h == 0) {
+		return;
+	}
+
+	this->markDirty(rect.x, rect.y, rect.x + rect.w, rect.y + rect.h);
+	this->submit({ DRAW_FILL, rect.x, rect.y, rect.w, rect.h, 0, 0, 0, color, 0 });
+}
+
+void OOScene2D::fillRect(const OORenderTarget& target, int x, int y, int w, int h, Color color) {
+	// One branch per primitive, the loops themselves are compiled for each format
+	switch (target.format) {
+	case PIXEL_R5G6B5:
+		this->fillRectAs(OOFormatR5G6B5(), target, x, y, w, h, color);
+		break;
+
+	default:
+		this->fillRectAs(OOFormatA8R8G8B8(), target, x, y, w, h, color);
+		break;
+	}
+}
+
+template <class Format> void OOScene2D::fillRectAs(Format format, const OORenderTarget& target, int x, int y, int w, int h, Color color) {
+	typedef typename Format::Pixel Pixel;
+
+	// Clip the rectangle against the target once, instead of per pixel
+	int x0 = std::max(x, target.clip.x);
+	int y0 = std::max(y, target.clip.y);
+	int x1 = std::min(x + w, target.clip.x + target.clip.w);
+	int y1 = std::min(y + h, target.clip.y + target.clip.h);
+
+	if (x0 >= x1 || y0 >= y1) {
+		return;
+	}
+
+	Pixel encodedColor = encodePixel(format, color);
+	size_t spanWidth = x1 - x0;
+	bool stream = spanWidth * (y1 - y0) >= FILL_STREAM_THRESHOLD;
+
+	// The whole target in one go, this is what clears look like
+	if (spanWidth == target.pitch) {
+		fillSpan(static_cast<Pixel *>(target.pixels) + (y0 * target.pitch), encodedColor, spanWidth * (y1 - y0), stream);
+		return;
+	}
+
+	// Draw row-by-row, a whole span at a time
+	Pixel *row = static_cast<Pixel *>(target.pixels) + (y0 * target.pitch) + x0;
+	for (int yPos = y0; yPos < y1; yPos++) {
+		fillSpan(row, encodedColor, spanWidth, stream);
+		row += target.pitch;
+	}
+}
+
+void OOScene2D::blitSprite(const OORenderTarget& target, const OOPNG& png, int x, int y, int left, int top, int w, int h) {
+	switch (target.format) {
+	case PIXEL_R5G6B5:
+		this->blitSpriteAs(OOFormatR5G6B5(), target, png, x, y, left, top, w, h);
+		break;
+
+	default:
+		this->blitSpriteAs(OOFormatA8R8G8B8(), target, png, x, y, left, top, w, h);
+		break;
+	}
+}
+
+template <class Format> void OOScene2D::blitSpriteAs(Format format, const OORenderTarget& target, const OOPNG& png, int x, int y, int left, int top, int w, int h) {
+	typedef typename Format::Pixel Pixel;
+
+	// Clip the destination against the target, and skip the clipped part of the source too
+	int x0 = std::max(x, target.clip.x);
+	int y0 = std::max(y, target.clip.y);
+	int x1 = std::min(x + w, target.clip.x + target.clip.w);
+	int y1 = std::min(y + h, target.clip.y + target.clip.h);
+
+	if (x0 >= x1 || y0 >= y1) {
+		return;
+	}
+
+	// visible source columns
+	int srcX0 = left + (x0 - x);
+	int srcX1 = srcX0 + (x1 - x0);
+	int srcY = top + (y0 - y);
+
+	Pixel *row = static_cast<Pixel *>(target.pixels) + (y0 * target.pitch) + x0;
+	for (int yPos = y0; yPos < y1; yPos++, srcY++) {
+		const uint32_t *srcRow = png.pixels + (srcY * png.pitch);
+
+		for (int r = png.rowRuns[srcY]; r < png.rowRuns[srcY + 1]; r++) {
+			const OOPixelRun& run = png.runs[r];
+
+			// runs are sorted, nothing visible past this one
+			if (run.start >= srcX1) {
+				break;
+			}
+
+			int s0 = std::max(run.start, srcX0);
+			int s1 = std::min(run.start + run.length, srcX1);
+			if (s0 >= s1) {
+				continue;
+			}
+
+			Pixel *dst = row + (s0 - srcX0);
+			if (run.blend) {
+				blendSpan(dst, srcRow + s0, s1 - s0);
+			}
+			else {
+				copySpan(dst, srcRow + s0, s1 - s0);
+			}
+		}
+
+		row += target.pitch;
+	}
+}
+
+void OOScene2D::blitTransformed(const OORenderTarget& target, const OOPNG& png, int x, int y, int w, int h, const OOSpriteMapping& mapping) {
+	switch (target.format) {
+	case PIXEL_R5G6B5:
+		this->blitTransformedAs(OOFormatR5G6B5(), target, png, x, y, w, h, mapping);
+		break;
+
+	default:
+		this->blitTransformedAs(OOFormatA8R8G8B8(), target, png, x, y, w, h, mapping);
+		break;
+	}
+}
+
+template <class Format> void OOScene2D::blitTransformedAs(Format format, const OORenderTarget& target, const OOPNG& png, int x, int y, int w, int h, const OOSpriteMapping& mapping) {
+	typedef typename Format::Pixel Pixel;
+
+	int x0 = std::max(x, target.clip.x);
+	int y0 = std::max(y, target.clip.y);
+	int x1 = std::min(x + w, target.clip.x + target.clip.w);
+	int y1 = std::min(y + h, target.clip.y + target.clip.h);
+
+	if (x0 >= x1 || y0 >= y1) {
+		return;
+	}
+
+	int64_t limitU = static_cast<int64_t>(png.width) << 16;
+	int64_t limitV = static_cast<int64_t>(png.height) << 16;
+	bool axisAligned = mapping.dvdx == 0 && mapping.dudy == 0;
+	uint32_t samples[BLEND_CHUNK];
+
+	Pixel *row = static_cast<Pixel *>(target.pixels) + (y0 * target.pitch);
+	for (int yPos = y0; yPos < y1; yPos++, row += target.pitch) {
+		int64_t u = mapping.u0 + (static_cast<int64_t>(x0 - x) * mapping.dudx) + (static_cast<int64_t>(yPos - y) * mapping.dudy);
+		int64_t v = mapping.v0 + (static_cast<int64_t>(x0 - x) * mapping.dvdx) + (static_cast<int64_t>(yPos - y) * mapping.dvdy);
+
+		// Only the pixels that land inside the sprite, so the sampling loops don't check bounds
+		int i0 = 0;
+		int i1 = x1 - x0;
+		clipSteps(u, mapping.dudx, limitU, i0, i1);
+		clipSteps(v, mapping.dvdx, limitV, i0, i1);
+
+		uint32_t su = static_cast<uint32_t>(u + (static_cast<int64_t>(i0) * mapping.dudx));
+		uint32_t sv = static_cast<uint32_t>(v + (static_cast<int64_t>(i0) * mapping.dvdx));
+		Pixel *dst = row + x0;
+
+		// Unscaled rows (vertical flips) blend straight from the sprite
+		if (axisAligned && mapping.dudx == 0x10000) {
+			blendSpan(dst + i0, png.pixels + ((sv >> 16) * png.pitch) + (su >> 16), i1 - i0);
+			continue;
+		}
+
+		for (int i = i0; i < i1;) {
+			int n = std::min(i1 - i, BLEND_CHUNK);
+
+			if (axisAligned) {
+				sampleRow(samples, png.pixels + ((sv >> 16) * png.pitch), png.width, su, mapping.dudx, mapping.repeat, n);
+			}
+			else {
+				sampleSpan(samples, png.pixels, png.pitch, su, sv, mapping.dudx, mapping.dvdx, n);
+			}
+
+			blendSpan(dst + i, samples, n);
+			su += static_cast<uint32_t>(n) * static_cast<uint32_t>(mapping.dudx);
+			sv += static_cast<uint32_t>(n) * static_cast<uint32_t>(mapping.dvdx);
+			i += n;
+		}
+	}
+}
+
+void OOScene2D::blitGlyphs(const OORenderTarget& target, const OOGlyphAtlas& atlas, const OOGlyphQuad *quads, size_t count, Color col) {
+	switch (target.format) {
+	case PIXEL_R5G6B5:
+		this->blitGlyphsAs(OOFormatR5G6B5(), target, atlas, quads, count, col);
+		break;
+
+	default:
+		this->blitGlyphsAs(OOFormatA8R8G8B8(), target, atlas, quads, count, col);
+		break;
+	}
+}
+
+template <class Format> void OOScene2D::blitGlyphsAs(Format format, const OORenderTarget& target, const OOGlyphAtlas& atlas, const OOGlyphQuad *quads, size_t count, Color col) {
+	typedef typename Format::Pixel Pixel;
+
+	// Coverage is blended in A8R8G8B8 whatever the target is
+	uint32_t encodedColor = encodeColor(col);
+
+	for (size_t i = 0; i < count; i++) {
+		const OOGlyphQuad& quad = quads[i];
 
-	// Draw row-by-row, column-by-column
-	for (yPos = y; yPos < y + h; yPos++) {
-		for (xPos = x; xPos < x + w; xPos++) {
-			this->DrawPixel(xPos, yPos, color);
+		// One clip test per glyph, instead of one per pixel
+		int x0 = std::max(quad.dstX, target.clip.x);
+		int y0 = std::max(quad.dstY, target.clip.y);
+		int x1 = std::min(quad.dstX + quad.w, target.clip.x + target.clip.w);
+		int y1 = std::min(quad.dstY + quad.h, target.clip.y + target.clip.h);
+
+		if (x0 >= x1 || y0 >= y1) {
+			continue;
+		}
+
+		const uint8_t *src = atlas.pixels.data() + ((quad.srcY + (y0 - quad.dstY)) * atlas.pitch) + quad.srcX + (x0 - quad.dstX);
+		Pixel *row = static_cast<Pixel *>(target.pixels) + (y0 * target.pitch) + x0;
+		for (int yPos = y0; yPos < y1; yPos++) {
+			blendCoverageSpan(row, src, encodedColor, x1 - x0);
+			row += target.pitch;
+			src += atlas.pitch;
 		}
 	}
 }
@@ -837,70 +4655,58 @@ void OOScene2D::DrawTextContainer(const std::string& txt, int font, int startX,
 	DEBUGLOG << "[DEBUG] [SCENE2D] DrawTextContainer() Function not implemented!";
 }
 
-void OOScene2D::drawText(const char *txt, FT_Face face, int startX, int startY, Color col) {
-	int rc;
+void OOScene2D::drawText(const OORenderTarget& target, const char *txt, FT_Face face, int startX, int startY, Color col) {
+	// CalcTextDim may be using the cache on the game thread while we draw on the render thread
+	std::lock_guard<std::mutex> lock(this->glyphMutex);
+
+	// Turn the whole string into atlas quads first, then blend them all in one go
+	this->glyphCache.BeginBatch();
+	this->glyphQuads.clear();
+
+	const OOGlyphAtlas *atlas = this->layoutText(txt, face, startX, startY, this->glyphQuads);
+	if (atlas != nullptr) {
+		this->blitGlyphs(target, *atlas, this->glyphQuads.data(), this->glyphQuads.size(), col);
+	}
+}
+
+const OOGlyphAtlas *OOScene2D::layoutText(const char *txt, FT_Face face, int startX, int startY, std::vector<OOGlyphQuad>& quads) {
+	// Appends the quads of the string, the caller holds the glyph lock and has begun a batch
 	int xOffset = 0;
 	int yOffset = 0;
-
-	// Get the glyph slot for bitmap and font metrics
-	FT_GlyphSlot slot = face->glyph;
+	int lineHeight = this->glyphCache.GetLineHeight(face);
+	FT_UInt previous = 0;
+	const OOGlyphAtlas *atlas = nullptr;
 
 	// Iterate each character of the text to write to the screen
 	size_t len = strlen(txt);
 	for (int n = 0; n < len; n++) {
-		FT_UInt glyph_index;
-
-		// Get the glyph for the ASCII code
-		glyph_index = FT_Get_Char_Index(face, txt[n]);
-
-		// Load and render in 8-bit color
-		rc = FT_Load_Glyph(face, glyph_index, FT_LOAD_DEFAULT);
-		if (rc) continue;
-
-		rc = FT_Render_Glyph(slot, ft_render_mode_normal);
-		if (rc) continue;
-
 		// If we get a newline, increment the y offset, reset the x offset, and skip to the next character
 		if (txt[n] == '\n') {
 			xOffset = 0;
-			yOffset += slot->bitmap.width * 2;
+			yOffset += lineHeight;
+			previous = 0;
 			continue;
 		}
 
-		// Parse and write the bitmap to the frame buffer
-		for (int yPos = 0; yPos < slot->bitmap.rows; yPos++) {
-			for (int xPos = 0; xPos < slot->bitmap.width; xPos++) {
-				// Decode the 8-bit bitmap
-				char pixel = slot->bitmap.buffer[(yPos * slot->bitmap.width) + xPos];
-
-				// Get new pixel coordinates to account for the character position and baseline, as well as newlines
-				int x = startX + xPos + xOffset + slot->bitmap_left;
-				int y = startY + yPos + yOffset - slot->bitmap_top;
+		// Get the rendered glyph for the ASCII code, FreeType is only involved on a cache miss
+		const OOGlyph *glyph = this->glyphCache.Get(face, static_cast<unsigned char>(txt[n]));
+		if (!glyph->rendered) continue;
 
-				// Linearly interpolate between the foreground and background for smoother rendering
-				uint8_t r = (pixel * col.r) / 255;
-				uint8_t g = (pixel * col.g) / 255;
-				uint8_t b = (pixel * col.b) / 255;
+		xOffset += this->glyphCache.GetKerning(face, previous, glyph->index);
+		previous = glyph->index;
 
-				// Create new color struct with lerp'd values
-				Color finalColor = { r, g, b };
-
-				// We need to do bounds checking before commiting the pixel write due to our transformations, or we
-				// could write out-of-bounds of the frame buffer
-				if (x < 0 || y < 0 || x >= this->width || y >= this->height) {
-					continue;
-				}
-
-				// If the pixel in the bitmap isn't blank, we'll draw it
-				if (pixel != 0) {
-					this->DrawPixel(x, y, finalColor);
-				}
-			}
+		// Get new coordinates to account for the character position and baseline, as well as newlines
+		if (glyph->width > 0 && glyph->rows > 0) {
+			quads.push_back({ glyph->atlasX, glyph->atlasY, glyph->width, glyph->rows, startX + xOffset + glyph->left, startY + yOffset - glyph->top });
 		}
 
+		atlas = glyph->atlas;
+
 		// Increment x offset for the next character
-		xOffset += slot->advance.x >> 6;
+		xOffset += glyph->advance;
 	}
+
+	return atlas;
 }
 
 void OOScene2D::DrawText(const std::string& txt, int font, int startX, int startY, Color col) {
@@ -908,55 +4714,67 @@ void OOScene2D::DrawText(const std::string& txt, int font, int startX, int start
 		OOCRASHMSG("Font index out of range.");
 	}
 
-	this->drawText(txt.c_str(), this->fonts[font], startX, startY, col);
+	OORect bounds;
+	if (!this->textBounds(txt.c_str(), this->fonts[font], startX, startY, bounds)) {
+		return;
+	}
+
+	bounds = intersectRect(bounds, this->clip);
+	if (bounds.w == 0 || bounds.h == 0) {
+		return;
+	}
+
+	this->markDirty(bounds.x, bounds.y, bounds.x + bounds.w, bounds.y + bounds.h);
+	this->submit({ DRAW_TEXT, startX, startY, this->clip.w, this->clip.h, this->clip.x, this->clip.y, font, col, 0 }, txt.c_str());
 }
 
-int getNewLine(FT_Face face) {
-	FT_UInt glyph_index = FT_Get_Char_Index(face, '\n');
-	FT_Load_Glyph(face, glyph_index, FT_LOAD_DEFAULT);
-	FT_Render_Glyph(face->glyph, ft_render_mode_normal);
-	return (face->glyph->bitmap.width * 2);
+bool OOScene2D::textBounds(const char *txt, FT_Face face, int startX, int startY, OORect& out) {
+	// Conservative on-screen bounds of a string, from metrics only.
+	// Every glyph bitmap fits in an atlas cell around its pen position, so pad the text box by one cell.
+	TextDim dim;
+	int cellW, cellH, lineHeight;
+	{
+		std::lock_guard<std::mutex> lock(this->glyphMutex);
+		this->calcTextDim(txt, face, dim);
+		this->glyphCache.GetCellSize(face, cellW, cellH);
+		lineHeight = this->glyphCache.GetLineHeight(face);
+	}
+
+	int x0 = std::max(startX - cellW, 0);
+	int y0 = std::max(startY - cellH, 0);
+	int x1 = std::min(startX + dim.w + cellW, this->width);
+	int y1 = std::min(startY + (dim.h - lineHeight) + cellH, this->height);
+
+	out = { x0, y0, x1 - x0, y1 - y0 };
+	return x0 < x1 && y0 < y1;
 }
 
 void OOScene2D::calcTextDim(const char *txt, FT_Face face, TextDim& textDimm) {
-	int rc;
+	// Only advances, kerning and line metrics are needed here, nothing gets rasterized
 	int xOffset = 0;
-	int yOffset = 0;
+	int lineHeight = this->glyphCache.GetLineHeight(face);
+	FT_UInt previous = 0;
 
-	// Get the glyph slot for bitmap and font metrics
-	FT_GlyphSlot slot = face->glyph;
+	textDimm.w = 0;
+	textDimm.h = lineHeight;
 
-	// Iterate each character of the text to write to the screen
+	// Iterate each character of the text
 	size_t len = strlen(txt);
-	textDimm.h = getNewLine(face);
-	int nl = textDimm.h;
 	for (int n = 0; n < len; n++) {
-		FT_UInt glyph_index;
-
-		// Get the glyph for the ASCII code
-		glyph_index = FT_Get_Char_Index(face, txt[n]);
-
-		// Load and render in 8-bit color
-		rc = FT_Load_Glyph(face, glyph_index, FT_LOAD_DEFAULT);
-		if (rc) {
-			continue;
-		}
-
-		rc = FT_Render_Glyph(slot, ft_render_mode_normal);
-		if (rc) {
-			continue;
-		}
-
-		// If we get a newline, increment the y offset, reset the x offset, update y size, and skip to the next character
+		// If we get a newline, reset the x offset, update y size, and skip to the next character
 		if (txt[n] == '\n') {
 			xOffset = 0;
-			yOffset += slot->bitmap.width * 2; // what the hell? that makes no sense!
-			textDimm.h += nl;
+			previous = 0;
+			textDimm.h += lineHeight;
 			continue;
 		}
 
+		FT_UInt index;
+		int advance = this->glyphCache.GetAdvance(face, static_cast<unsigned char>(txt[n]), &index);
+
 		// Increment x offset for the next character
-		xOffset += slot->advance.x >> 6;
+		xOffset += this->glyphCache.GetKerning(face, previous, index) + advance;
+		previous = index;
 
 		// Update the x size to be the *widest* offset (in case of multiple lines that's important)
 		if (textDimm.w < xOffset) {
@@ -970,11 +4788,13 @@ void OOScene2D::CalcTextDim(const std::string& txt, int font, TextDim& textDimm)
 		OOCRASHMSG("Invalid font index.");
 	}
 
+	std::lock_guard<std::mutex> lock(this->glyphMutex);
 	this->calcTextDim(txt.c_str(), this->fonts[font], textDimm);
 }
 
 #pragma endregion
 
+#ifndef OOTOOLKIT_HEADLESS
 #pragma region // OOAudio
 
 OOAudio::OOAudio() {
@@ -1081,8 +4901,14 @@ int OOAudio::decodeOGGInternal(FILE* input) {
 }
 
 int OOAudio::InitSoundOGG(const std::string& fname) {
+	std::string key = OOAssetCache::FileKey(fname);
+	int cached = this->soundAssets.Acquire(key);
+	if (cached >= 0) {
+		return cached;
+	}
+
 	FILE* input = fopen(fname.c_str(), "rb");
-	return this->decodeOGGInternal(input);
+	return this->soundAssets.Insert(key, this->decodeOGGInternal(input));
 }
 
 int OOAudio::InitSoundOGG(size_t bufSize, unsigned char* buf) {
@@ -1090,8 +4916,15 @@ int OOAudio::InitSoundOGG(size_t bufSize, unsigned char* buf) {
 		OOCRASHMSG("Invalid buffer passed.");
 	}
 
+	// The samples are decoded into our own buffer, so equal contents can share them
+	std::string key = OOAssetCache::ContentKey(buf, bufSize);
+	int cached = this->soundAssets.Acquire(key);
+	if (cached >= 0) {
+		return cached;
+	}
+
 	FILE* meminput = fmemopen(buf, bufSize, "rb");
-	return this->decodeOGGInternal(meminput);
+	return this->soundAssets.Insert(key, this->decodeOGGInternal(meminput));
 }
 
 int OOAudio::decodeWAVInternal(drwav& dr) {
@@ -1119,6 +4952,12 @@ int OOAudio::decodeWAVInternal(drwav& dr) {
 int OOAudio::InitSoundWAV(const std::string& fname) {
 	int rc;
 	drwav dr;
+
+	std::string key = OOAssetCache::FileKey(fname);
+	int cached = this->soundAssets.Acquire(key);
+	if (cached >= 0) {
+		return cached;
+	}
 	
 	rc = drwav_init_file(&dr, fname.c_str(), nullptr);
 	if (!rc) {
@@ -1126,20 +4965,26 @@ int OOAudio::InitSoundWAV(const std::string& fname) {
 		return -1;
 	}
 
-	return this->decodeWAVInternal(dr);
+	return this->soundAssets.Insert(key, this->decodeWAVInternal(dr));
 }
 
 int OOAudio::InitSoundWAV(size_t bufSize, unsigned char* buf) {
 	int rc;
 	drwav dr;
 
+	std::string key = OOAssetCache::ContentKey(buf, bufSize);
+	int cached = this->soundAssets.Acquire(key);
+	if (cached >= 0) {
+		return cached;
+	}
+
 	rc = drwav_init_memory(&dr, buf, bufSize, nullptr);
 	if (!rc) {
 		DEBUGLOG << "[DEBUG] [AUDIO] [ERROR] Sound init fail! " << rc;
 		return -1;
 	}
 
-	return this->decodeWAVInternal(dr);
+	return this->soundAssets.Insert(key, this->decodeWAVInternal(dr));
 }
 
 int OOAudio::decodeMP3Internal(const char *fname) {
@@ -1175,8 +5020,14 @@ int OOAudio::decodeMP3Internal(const char *fname) {
 }
 
 int OOAudio::InitSoundMP3(const std::string& fname) {
+	std::string key = OOAssetCache::FileKey(fname);
+	int cached = this->soundAssets.Acquire(key);
+	if (cached >= 0) {
+		return cached;
+	}
+
 	int sound = this->decodeMP3Internal(fname.c_str());
-	return sound;
+	return this->soundAssets.Insert(key, sound);
 }
 
 int OOAudio::InitSoundMP3(size_t bufSize, unsigned char *buf) {
@@ -1418,6 +5269,11 @@ bool OOAudio::FreeSound(int index) {
 		OOCRASHMSG("Sound is already freed.");
 	}
 
+	// Shared with another load of the same sound
+	if (!this->soundAssets.Release(index)) {
+		return true;
+	}
+
 	delete[] this->audioSamples[index].sampleData;
 	this->audioSamples[index].sampleData = nullptr;
 	this->audioSamples[index].sampleCount = 0;
@@ -1428,6 +5284,7 @@ bool OOAudio::FreeSound(int index) {
 }
 
 #pragma endregion
+#endif
 
 #pragma region // OOToolkit
 
@@ -1445,6 +5302,7 @@ OOToolkit::~OOToolkit() {
 	DEBUGLOG << "[DEBUG] [TOOLKIT] Destructor called!";
 }
 
+#ifndef OOTOOLKIT_HEADLESS
 OOAudio *OOToolkit::GetAudio() {
 	if (this->Audio.get() == nullptr) {
 		DEBUGLOG << "[DEBUG] [TOOLKIT] Making audio...";
@@ -1453,6 +5311,7 @@ OOAudio *OOToolkit::GetAudio() {
 
 	return this->Audio.get();
 }
+#endif
 
 OOScene2D *OOToolkit::GetScene2D() {
 	if (this->Scene2D.get() == nullptr) {
@@ -1463,6 +5322,7 @@ OOScene2D *OOToolkit::GetScene2D() {
 	return this->Scene2D.get();
 }
 
+#ifndef OOTOOLKIT_HEADLESS
 OOController *OOToolkit::GetController() {
 	if (this->Controller.get() == nullptr) {
 		DEBUGLOG << "[DEBUG] [TOOLKIT] Making controller...";
@@ -1471,6 +5331,7 @@ OOController *OOToolkit::GetController() {
 
 	return this->Controller.get();
 }
+#endif
 
 OOTcpClient *OOToolkit::GetTcpClient() {
 	if (this->TcpClient.get() == nullptr) {
@@ -7,16 +7,33 @@
 #include <iostream>
 #include <stdint.h>
 #include <vector>
+#include <algorithm>
 #include <thread>
 #include <mutex>
 #include <unordered_map>
+#include <list>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <chrono>
+#include <functional>
+#include <memory>
+
+// Define OOTOOLKIT_HEADLESS to build OOScene2D for the host: frame buffers live in ordinary memory and flips are simulated.
+// Everything that needs the console (controller, audio) is left out of such a build.
 
 // FreeType
+#ifdef OOTOOLKIT_HEADLESS
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#else
 #include <proto-include.h>
+#endif
 
 #include "dr_wav.h"
 
 // PS4 specific stuff.
+#ifndef OOTOOLKIT_HEADLESS
 #include <orbis/Pad.h>
 #include <orbis/UserService.h>
 #include <orbis/libkernel.h>
@@ -24,6 +41,7 @@
 #include <orbis/Sysmodule.h>
 #include <orbis/AudioOut.h>
 #include <orbis/SystemService.h>
+#endif
 
 // this will log to stdout if no TCP connection was established, or to TCP...
 #define DEBUGLOG OOLog(__FUNCTION__, (g_ToolkitInstance ? (g_ToolkitInstance->GetTcpClient()->IsConnected() ? g_ToolkitInstance->GetTcpClient() : nullptr) : nullptr))
@@ -52,7 +70,7 @@ struct Color {
 	uint8_t r;
 	uint8_t g;
 	uint8_t b;
-	uint8_t a; // no alpha yet.
+	uint8_t a; // only sprites are alpha blended for now.
 };
 
 struct TextDim {
@@ -60,12 +78,30 @@ struct TextDim {
 	int h; // height
 };
 
+struct OORect {
+	int x;
+	int y;
+	int w; // width
+	int h; // height
+};
+
 struct SpriteDim {
 	int w; // width
 	int h; // height
 	int c; // channels
 };
 
+// How DrawPNGTransformed places a sprite: scaled and rotated around its origin, which lands on the position given to the draw.
+struct OOSpriteTransform {
+	float scaleX = 1.0f;
+	float scaleY = 1.0f;
+	float rotation = 0.0f; // in radians, clockwise.
+	int originX = 0; // in sprite pixels
+	int originY = 0;
+	bool flipX = false; // mirrored around the origin, same as a negative scale.
+	bool flipY = false;
+};
+
 // a stringstream tcp socket.
 class OOTcpClient {
 	std::stringstream myStream;
@@ -101,6 +137,7 @@ public:
 	}
 };
 
+#ifndef OOTOOLKIT_HEADLESS
 class OOController {
 	int pad;
 	int userID;
@@ -131,6 +168,55 @@ public:
 
 	std::string GetUserName();
 };
+#endif
+
+// Handles of loaded assets by where they came from, so loading the same thing twice hands out the same handle.
+// Handles are reference counted, the asset should only be freed once the last reference is released.
+class OOAssetCache {
+	struct Entry {
+		std::string key;
+		int refs;
+	};
+
+	std::unordered_map<std::string, int> handles;
+	std::unordered_map<int, Entry> entries;
+
+public:
+	int Acquire(const std::string& key); // another reference to a cached handle, -1 if not cached.
+	int Insert(const std::string& key, int handle); // caches a freshly loaded handle, failed loads (< 0) are ignored.
+	bool Release(int handle); // true if the asset can be freed, false if it's still referenced.
+
+	static std::string FileKey(const std::string& path);
+	static std::string ContentKey(const void *data, size_t size); // hashes the data, for loaders that copy it.
+	static std::string BufferKey(const void *data, size_t size); // the buffer itself, for loaders that keep using it.
+};
+
+// A horizontal run of sprite pixels that can all be drawn the same way.
+// Fully transparent runs are not stored at all, they're simply skipped.
+struct OOPixelRun {
+	int start; // first column of the run.
+	int length;
+	bool blend; // false - every pixel is opaque and can be copied, true - the pixels must be alpha blended.
+};
+
+// Header of a baked sprite file (made from a PNG by tools/oobake), its pixels are already in the frame buffer format.
+// Followed by rowRuns (height + 1 int32s), runCount OOSpriteFileRuns and width * height A8R8G8B8 pixels.
+struct OOSpriteFileHeader {
+	char magic[4]; // "OOSP"
+	uint32_t version;
+	int32_t width;
+	int32_t height;
+	int32_t channels; // of the source image.
+	int32_t runCount;
+	uint64_t sourceSize; // of the image file it was baked from, a bake that doesn't match its image is stale.
+	int64_t sourceTime; // modification time of the image file, in seconds.
+};
+
+struct OOSpriteFileRun {
+	int32_t start;
+	int32_t length;
+	int32_t blend;
+};
 
 class OOScene2D; // cyclic dependency, OOPNG wants OOScene2D which is dependant on OOPNG.
 
@@ -138,23 +224,432 @@ class OOPNG {
 	int width;
 	int height;
 	int channels;
-	uint32_t *img;
+	uint32_t *img; // pixels in the frame buffer format (A8R8G8B8), null once packed into a sprite page.
+
+	// Where drawing reads from: img, or the sprite's spot in a page. Null if freed.
+	const uint32_t *pixels;
+	int pitch; // in pixels
+	int page; // -1 if the sprite has its own buffer.
+	int pageX;
+	int pageY;
+
+	std::vector<OOPixelRun> runs;
+	std::vector<int> rowRuns; // index of the first run of every row, plus one past the last row.
+
+	bool loading; // still being decoded in the background, draws nothing until it's published.
+	bool failed; // couldn't be decoded in the background, draws nothing until it's freed.
+
+	OOPNG(); // an empty sprite, stands in for one that's loading.
+
+	bool load(const char *imagePath, std::vector<std::string>& messages); // messages are for the caller to log, loader threads mustn't.
+	void encodePixels();
+	void classifyRuns();
+	bool loadBaked(const char *path, const char *imagePath, std::vector<std::string>& messages);
+	bool decodeQOI(const unsigned char *data, size_t size);
+	void release(); // frees the pixels, the object stays around as a freed sprite.
+	void setOwnPixels();
+	bool clipPart(int& startX, int& startY, int& left, int& top, int& width, int& height) const;
+
+	friend class OOScene2D;
 
 public:
 	OOPNG(const char *imagePath);
 	OOPNG(size_t bufsize, unsigned char* bufpng);
+	OOPNG(int w, int h, const Color *pixels);
+	OOPNG(const OOPNG&) = delete;
+	OOPNG(OOPNG&& other) noexcept;
+	OOPNG& operator=(OOPNG&& other) noexcept;
 	~OOPNG();
 
 	bool IsFreed();
-	void Draw(OOScene2D& scene, int startX, int startY);
-	void DrawPart(OOScene2D& scene, int startX, int startY, int left, int top, int width, int height);
 	void GetInfo(SpriteDim& out);
+	bool SaveBaked(const std::string& fname, const std::string& imagePath);
+
+	static std::string BakedPath(const std::string& imagePath);
+};
+
+// A PNG decoded by the loader threads, for the sprite handle it was requested for.
+struct OOPNGLoad {
+	int index;
+	std::string path;
+	std::unique_ptr<OOPNG> png; // set once decoded.
+	std::vector<std::string> messages; // what decoding had to say, logged on the game thread.
+};
+
+struct OOGlyphAtlas;
+
+// A rendered glyph, kept around so text doesn't have to go through FreeType every frame.
+struct OOGlyph {
+	const OOGlyphAtlas *atlas; // where the coverage bitmap lives.
+	FT_UInt index; // glyph index in the face.
+	int atlasX; // top-left corner of the bitmap in the atlas.
+	int atlasY;
+	int width;
+	int rows;
+	int left; // horizontal bearing
+	int top; // vertical bearing
+	int advance; // in pixels
+	bool rendered; // false if FreeType failed to load or render the glyph.
+};
+
+// A glyph to draw: the part of the atlas to blend and where it goes.
+struct OOGlyphQuad {
+	int srcX;
+	int srcY;
+	int w;
+	int h;
+	int dstX;
+	int dstY;
+};
+
+// All glyphs of one face at one pixel size, packed into a single 8-bit coverage atlas.
+// The atlas is a grid of equally sized cells, so evicting a glyph simply frees its cell for the next one.
+struct OOGlyphAtlas {
+	struct Entry {
+		FT_UInt index;
+		int cell;
+		unsigned stamp; // batch the glyph was last used in.
+		OOGlyph glyph;
+	};
+
+	std::vector<uint8_t> pixels;
+	int pitch; // bytes per atlas row
+	int cellWidth;
+	int cellHeight;
+	int columns; // cells per row of cells
+	int cellCount; // cells allocated so far
+	std::vector<int> freeCells;
+
+	std::list<Entry> lru; // most recently used first.
+	std::unordered_map<FT_UInt, std::list<Entry>::iterator> entries;
+
+	// Metrics are tiny, so they are kept for every glyph ever seen, rendered or not.
+	std::unordered_map<FT_UInt, int> advances;
+	std::unordered_map<uint64_t, int> kerning; // left << 32 | right
+};
+
+// LRU cache of rendered glyphs, keyed by face, pixel size and glyph index.
+class OOGlyphCache {
+	struct AtlasKey {
+		FT_Face face;
+		uint32_t size; // x_ppem << 16 | y_ppem
+
+		bool operator==(const AtlasKey& other) const;
+	};
+
+	struct CharKey {
+		FT_Face face;
+		unsigned long charCode;
+
+		bool operator==(const CharKey& other) const;
+	};
+
+	struct KeyHash {
+		size_t operator()(const AtlasKey& key) const;
+		size_t operator()(const CharKey& key) const;
+	};
+
+	std::unordered_map<AtlasKey, OOGlyphAtlas, KeyHash> atlases;
+	std::unordered_map<CharKey, FT_UInt, KeyHash> charIndices;
+
+	size_t budget; // in bytes, per atlas
+	unsigned stamp;
+
+	FT_UInt charIndex(FT_Face face, unsigned long charCode);
+	OOGlyphAtlas& atlasFor(FT_Face face);
+	void initAtlas(OOGlyphAtlas& atlas, FT_Face face);
+	int allocateCell(OOGlyphAtlas& atlas);
+
+public:
+	OOGlyphCache();
+
+	void SetBudget(size_t bytes);
+	void BeginBatch();
+	const OOGlyph *Get(FT_Face face, unsigned long charCode);
+	int GetAdvance(FT_Face face, unsigned long charCode, FT_UInt *index);
+	int GetKerning(FT_Face face, FT_UInt left, FT_UInt right);
+	int GetLineHeight(FT_Face face);
+	void GetCellSize(FT_Face face, int& w, int& h);
+	void Purge(FT_Face face);
+};
+
+// Pixel layouts a render target can have. Frame buffers are always A8R8G8B8, R5G6B5 is only used for back buffers.
+enum OOPixelFormat {
+	PIXEL_A8R8G8B8, // 0x80RRGGBB
+	PIXEL_R5G6B5,
+};
+
+// How frames drawn at a lower internal resolution are scaled up to the display.
+enum OOScaleFilter {
+	SCALE_NEAREST, // blocky, exact for pixel art at whole-number factors.
+	SCALE_BILINEAR, // smooth.
+};
+
+// One output pixel of an upscale along one axis: the input pixels it mixes, and how much of `next` (out of 256).
+struct OOScaleTap {
+	int src;
+	int next;
+	uint32_t weight;
+};
+
+// Where rasterization goes: a frame buffer, and the part of it that may be drawn to.
+struct OORenderTarget {
+	void *pixels; // of the format's pixel type.
+	int width;
+	int height;
+	int pitch; // in pixels
+	OOPixelFormat format;
+	OORect clip; // nothing outside of it is touched.
+};
+
+enum OODrawType {
+	DRAW_FILL, // x, y, w, h, color
+	DRAW_PIXEL, // x, y, color
+	DRAW_SPRITE, // x, y, left, top, w, h, index
+	DRAW_TEXT, // x, y, index (font), color, text, clipped to left, top, w, h
+	DRAW_SPRITE_TRANSFORMED, // x, y, w, h (destination), index, text (mapping)
+};
+
+// Inverse mapping of a transformed sprite, in 16.16 fixed point: the sprite position sampled by the center of
+// the command's top-left pixel, and how far it moves per pixel to the right and down.
+struct OOSpriteMapping {
+	int64_t u0;
+	int64_t v0;
+	int32_t dudx;
+	int32_t dvdx;
+	int32_t dudy;
+	int32_t dvdy;
+	int32_t repeat; // pixels every texel of a row covers, for axis aligned whole number scales. 0 otherwise.
+};
+
+// A recorded draw call.
+struct OODrawCommand {
+	OODrawType type;
+	int x;
+	int y;
+	int w;
+	int h;
+	int left;
+	int top;
+	int index; // sprite or font
+	Color color;
+	size_t text; // offset of the string in the command list's text buffer, or index of the mapping.
+};
+
+struct OOCommandList {
+	std::vector<OODrawCommand> commands;
+	std::vector<char> text; // all strings of the frame, null terminated.
+	std::vector<OOSpriteMapping> mappings; // of the transformed sprites.
+	std::vector<uint8_t> rows; // per screen row, whether the frame draws into it. Only kept with a back buffer.
+
+	void Clear();
+};
+
+// A string laid out ahead of tiled rendering: its glyph quads in the frame's quad list.
+struct OOTextRun {
+	const OOGlyphAtlas *atlas; // null if nothing is drawn.
+	size_t firstQuad;
+	size_t quadCount;
+};
+
+// Shows finished frame buffers on the display, one flip per vblank.
+class OOFlipQueue {
+public:
+	virtual ~OOFlipQueue();
+
+	virtual bool Submit(int bufferIndex, int64_t flipArg) = 0;
+	virtual int64_t GetFlipArg() = 0; // arg of the last flip that happened.
+	virtual bool WaitFlip() = 0; // blocks until a flip happens, returns right away if one happened since the last wait.
+	virtual bool GetFlipTime(int64_t flipArg, std::chrono::steady_clock::time_point& time) = 0; // when that flip happened, false if that isn't known.
+};
+
+#ifndef OOTOOLKIT_HEADLESS
+// The real display.
+class OOVideoOutFlipQueue : public OOFlipQueue {
+	int video;
+	OrbisKernelEqueue queue;
+
+public:
+	OOVideoOutFlipQueue(int videoHandle);
+	~OOVideoOutFlipQueue();
+
+	bool Init();
+
+	bool Submit(int bufferIndex, int64_t flipArg) override;
+	int64_t GetFlipArg() override;
+	bool WaitFlip() override;
+	bool GetFlipTime(int64_t flipArg, std::chrono::steady_clock::time_point& time) override;
+};
+#endif
+
+// A stand-in display for the host, flips are timed by a simulated vblank.
+class OOSimulatedFlipQueue : public OOFlipQueue {
+	std::thread vblankThread;
+	std::mutex mutex;
+	std::condition_variable cond;
+	std::deque<std::pair<int, int64_t>> pending; // buffer index, flip arg
+	std::deque<std::pair<int64_t, std::chrono::steady_clock::time_point>> flipTimes; // vblanks of the last few flips, flip arg and time
+	std::chrono::nanoseconds period;
+	int64_t flipArg;
+	int displayedBuffer;
+	int events; // flips since the last wait
+	bool stop;
+
+	void vblankMain();
+
+public:
+	OOSimulatedFlipQueue(int refreshRate = 60);
+	~OOSimulatedFlipQueue();
+
+	bool Submit(int bufferIndex, int64_t flipArg) override;
+	int64_t GetFlipArg() override;
+	bool WaitFlip() override;
+	bool GetFlipTime(int64_t flipArg, std::chrono::steady_clock::time_point& time) override;
+	int GetDisplayedBuffer();
+};
+
+// min / average / 99th percentile over the last frames, in microseconds.
+struct OOTimingStats {
+	double min;
+	double avg;
+	double p99;
+};
+
+struct OOFrameStats {
+	OOTimingStats draw; // first draw call to last draw call.
+	OOTimingStats frame; // first draw call to the flip submit.
+	OOTimingStats present; // flip submit to the flip being observed.
+	OOTimingStats interval; // between two observed flips.
+	uint64_t frames; // frames shown since the stats were enabled.
+	uint64_t droppedFrames; // replaced in the mailbox before they were shown.
+	uint64_t missedVsyncs; // vblanks that showed an old frame again.
+};
+
+// Timestamps of a frame that hasn't been seen on screen yet.
+struct OOFrameTiming {
+	int frameID;
+	std::chrono::steady_clock::time_point firstDraw;
+	std::chrono::steady_clock::time_point lastDraw;
+	std::chrono::steady_clock::time_point submit;
+	bool presented;
+	bool dropped;
+};
+
+// A finished frame, in microseconds.
+struct OOFrameSample {
+	float draw;
+	float frame;
+	float present;
+	float interval;
+};
+
+enum OOPresentMode {
+	PRESENT_SYNC, // Commit waits until the frame is on screen.
+	PRESENT_QUEUED, // Commit queues the flip and only waits for a free back buffer.
+	PRESENT_MAILBOX, // Commit never waits for the display, a frame still waiting for its flip gets replaced by a newer one.
+};
+
+// A column range of a sprite page's skyline: everything below y is taken.
+struct OOSkylineNode {
+	int x;
+	int y;
+	int width;
+};
+
+// Small sprites are packed together into big pages, instead of each living in its own heap block.
+struct OOSpritePage {
+	std::vector<uint32_t> pixels; // empty if the page isn't in use.
+	std::vector<OOSkylineNode> skyline;
+	std::vector<int> sprites; // handles packed into this page.
+	size_t used; // pixels of live sprites
+};
+
+// Usage of the video memory region, in bytes.
+struct OOVideoMemStats {
+	size_t total;
+	size_t used; // handed out, rounded up to the 64 byte granule. Padding in front of aligned allocations stays free.
+	size_t peak;
+	size_t largestFree; // the biggest allocation that's sure to succeed (at the minimum alignment), requests are rounded up to a size class.
+	size_t allocations;
+	size_t freeBlocks;
+};
+
+// General purpose allocator over a fixed memory region, two-level segregated fit (TLSF).
+// Allocation and freeing are O(1). The bookkeeping lives on the heap, nothing is ever read back from video memory.
+class OOVideoAllocator {
+	struct Block {
+		size_t offset;
+		size_t size;
+		bool free;
+		Block *prevPhys; // neighbours in address order.
+		Block *nextPhys;
+		Block *prevFree; // free list of the block's size class.
+		Block *nextFree;
+	};
+
+	char *base;
+	size_t size;
+	Block *first; // lowest address, null if there's no region.
+	uint64_t flBitmap; // first level classes with a free block.
+	uint32_t slBitmap[64]; // second level classes with a free block, per first level.
+	Block *freeLists[64][16];
+	std::unordered_map<size_t, Block *> usedBlocks; // by offset
+	size_t usedBytes;
+	size_t peakBytes;
+	size_t freeCount;
+
+	static void mapping(size_t bytes, int& fl, int& sl);
+	void insertFree(Block *block);
+	void removeFree(Block *block);
+	Block *findFree(size_t bytes);
+	Block *split(Block *block, size_t bytes);
+	void destroy();
+
+public:
+	OOVideoAllocator();
+	OOVideoAllocator(const OOVideoAllocator&) = delete;
+	~OOVideoAllocator();
+
+	void Init(void *memory, size_t bytes);
+	void *Allocate(size_t bytes, size_t alignment);
+	void Free(void *ptr);
+	void GetStats(OOVideoMemStats& out);
 };
 
 class OOScene2D {
 	FT_Library ftLib;
+	OOGlyphCache glyphCache;
+	std::vector<OOGlyphQuad> glyphQuads;
+	std::mutex glyphMutex; // the render thread and CalcTextDim both use the glyph cache.
 	std::vector<FT_Face> fonts;
 	std::vector<OOPNG> sprites;
+	std::vector<OOSpritePage> spritePages;
+	OOAssetCache spriteAssets;
+	OOAssetCache fontAssets;
+
+	// Clip rectangle every draw is limited to, and the ones PushClip saved.
+	OORect clip;
+	std::vector<OORect> clipStack;
+
+	// DrawPNGBatch scratch space, kept so batches don't allocate every frame.
+	std::vector<int> batchW;
+	std::vector<int> batchH;
+	std::vector<OORect> batchRects; // visible part of every item, w or h <= 0 if none.
+	std::vector<uint32_t> batchOrder; // visible items, grouped by source.
+
+	// Background PNG decoding. Loaders only decode, the sprites are published on the game thread.
+	std::vector<std::thread> loaders;
+	std::mutex loadMutex;
+	std::condition_variable loadCond; // work queued, or stopping.
+	std::condition_variable loadDoneCond; // a load finished.
+	std::deque<OOPNGLoad> loadQueue;
+	std::vector<OOPNGLoad> loadDone;
+	int loadsPending; // requested but not published yet, game thread only.
+	bool loadStop;
+
+	void loaderMain();
+	void stopLoaders();
+	void publishLoads();
 
 	int width;
 	int height;
@@ -164,12 +659,13 @@ class OOScene2D {
 	off_t directMemOff;
 	size_t directMemAllocationSize;
 
-	char *videoMemSP;
 	void *videoMem;
+	OOVideoAllocator videoAllocator; // hands out videoMem.
 
 	char **frameBuffers;
-	OrbisKernelEqueue flipQueue;
+#ifndef OOTOOLKIT_HEADLESS
 	OrbisVideoOutBufferAttribute attr;
+#endif
 
 	int frameBufferSize;
 	int frameBufferCount;
@@ -177,22 +673,146 @@ class OOScene2D {
 
 	int activeFrameBufferIdx;
 
-	bool initFlipQueue();
+	// Swap chain: which frame each buffer last presented, so we know when the display is done with it.
+	std::unique_ptr<OOFlipQueue> flipper;
+	OOPresentMode presentMode;
+	std::vector<int> bufferFrames; // -1 if the buffer isn't in use.
+	int mailboxBuffer; // presented, waiting for its flip, -1 if none.
+	std::thread presentThread;
+	std::mutex presentMutex;
+	std::condition_variable presentCond;
+	bool presentStop;
+
+	bool bufferFree(int bufferIndex);
+	void waitDisplay(const std::function<bool()>& done);
+	void acquireBuffer(int bufferIndex);
+	void present(int bufferIndex, int frameID);
+	void presentThreadMain();
+	void startPresenter();
+	void stopPresenter();
+
+	// Frame timing, only measured while enabled. Draw timestamps are taken on the game thread, the rest under the stats lock.
+	std::atomic<bool> frameStats;
+	bool drawStarted;
+	std::chrono::steady_clock::time_point firstDraw;
+	std::chrono::steady_clock::time_point lastDraw;
+	std::mutex statsMutex;
+	std::deque<OOFrameTiming> frameTimings; // presented or about to be, oldest first.
+	std::vector<OOFrameSample> frameSamples; // ring of the last FRAME_STATS_WINDOW frames.
+	size_t nextSample;
+	std::chrono::steady_clock::time_point lastFlip;
+	uint64_t flipsUntimed; // shown since lastFlip, without a flip time of their own.
+	uint64_t framesShown;
+	uint64_t framesDropped;
+	uint64_t vsyncsMissed;
+
+	void stampPresent(int frameID, bool dropped);
+	void observeFlips();
+
+	// What was drawn into each frame buffer since it was last cleared, so clearing can skip the rest.
+	bool dirtyTracking;
+	std::vector<std::vector<OORect>> dirtyRects;
+
+	void markDirty(int x0, int y0, int x1, int y1);
+	std::vector<OORect>& dirtyList();
+
+	// Cached back buffer: frames are drawn in system memory and the rows they touched are streamed to the frame buffer on present.
+	std::vector<uint8_t> backBuffer; // empty if off.
+	OOPixelFormat renderFormat; // of the back buffer, R5G6B5 always has one.
+	std::vector<std::vector<uint8_t>> staleRows; // per frame buffer, the rows that differ from the back buffer.
+
+	void markRows(int y0, int y1);
+	void resolveBackBuffer(int bufferIndex, std::vector<uint8_t>& rows);
+
+	// Internal resolution: frames are drawn at width x height into the back buffer and scaled up to the display on present.
+	int displayWidth;
+	int displayHeight;
+	OOScaleFilter scaleFilter;
+	std::vector<OOScaleTap> scaleTapsX; // per display column.
+	std::vector<OOScaleTap> scaleTapsY; // per display row.
+	std::vector<uint32_t> scaleSource; // a back buffer row, widened.
+	std::vector<uint32_t> scaleRows[2]; // back buffer rows scaled across, two so they can be mixed.
+	int scaleRowIndex[2]; // which rows those are.
+	std::vector<uint32_t> scaleLine; // one display row.
+
+	bool scaled();
+	void buildScaler();
+	const uint32_t *scaleRow(const OORenderTarget& source, int row, const uint32_t *keep);
+	void upscaleRows(uint32_t *dst, const std::vector<uint8_t>& stale);
+
+	// Command buffer mode: draw calls are recorded and rasterized by the render thread, a frame behind.
+	bool commandBuffering;
+	OOCommandList recordList; // the frame the game thread is building.
+	OOCommandList renderList; // the frame the render thread is drawing.
+	std::thread renderThread;
+	std::mutex renderMutex;
+	std::condition_variable renderCond;
+	bool renderBusy;
+	bool renderStop;
+	int renderBufferIdx;
+	int renderFrameID;
+
+	// Tiled rendering: command lists are binned into screen tiles, which the workers rasterize in parallel.
+	int tileColumns;
+	int tileRows;
+	std::vector<std::vector<uint32_t>> tileBins; // command indices per tile, in draw order.
+	std::vector<OOGlyphQuad> tileQuads; // the text of the list, laid out once for every tile.
+	std::vector<OOTextRun> tileTexts; // per command, only set for text.
+	const OOCommandList *tileList;
+	OORenderTarget tileTarget;
+	std::atomic<int> nextTile;
+	std::vector<std::thread> workers;
+	std::mutex workerMutex;
+	std::condition_variable workerCond;
+	unsigned workerGeneration; // bumped for every list, wakes the workers up.
+	int workersRunning;
+	bool workerStop;
+
+	OORenderTarget targetFor(int bufferIndex);
+	void submit(const OODrawCommand& cmd, const char *text = nullptr, const OOSpriteMapping *mapping = nullptr);
+	void execute(const OORenderTarget& target, const OODrawCommand& cmd, const char *text, const OOSpriteMapping *mapping = nullptr);
+	void executeList(const OORenderTarget& target, const OOCommandList& list);
+	void renderThreadMain();
+	void binList(const OORenderTarget& target, const OOCommandList& list);
+	void executeTiled(const OORenderTarget& target, const OOCommandList& list);
+	void renderTiles();
+	void renderTile(int tile);
+	void workerMain(unsigned generation);
+	void stopWorkers();
+	void waitRenderIdle();
+	void flushCommands();
+	void submitFlip(int bufferIndex, int frameID);
+
 	bool allocateFrameBuffers(int num);
-	char *allocateDisplayMem(size_t size);
 	bool allocateVideoMem(size_t size, int alignment);
 	void deallocateVideoMem();
 
+	bool packRect(OOSpritePage& page, int w, int h, int& x, int& y);
+	void packSprite(int index);
+	void unpackSprite(int index);
+	void compactPage(int pageIndex);
+
+	void fillRect(const OORenderTarget& target, int x, int y, int w, int h, Color color);
+	void blitSprite(const OORenderTarget& target, const OOPNG& png, int x, int y, int left, int top, int w, int h);
+	void blitTransformed(const OORenderTarget& target, const OOPNG& png, int x, int y, int w, int h, const OOSpriteMapping& mapping);
+	void blitGlyphs(const OORenderTarget& target, const OOGlyphAtlas& atlas, const OOGlyphQuad *quads, size_t count, Color col);
+	template <class Format> void fillRectAs(Format format, const OORenderTarget& target, int x, int y, int w, int h, Color color);
+	template <class Format> void blitSpriteAs(Format format, const OORenderTarget& target, const OOPNG& png, int x, int y, int left, int top, int w, int h);
+	template <class Format> void blitTransformedAs(Format format, const OORenderTarget& target, const OOPNG& png, int x, int y, int w, int h, const OOSpriteMapping& mapping);
+	template <class Format> void blitGlyphsAs(Format format, const OORenderTarget& target, const OOGlyphAtlas& atlas, const OOGlyphQuad *quads, size_t count, Color col);
+
 	bool initFont(FT_Face *face, const char *fontPath, int fontSize);
 	bool initMemFont(FT_Face *face, size_t bufSize, unsigned char* fontBuf, int fontSize);
-	void drawText(const char *txt, FT_Face face, int startX, int startY, Color col);
+	void drawText(const OORenderTarget& target, const char *txt, FT_Face face, int startX, int startY, Color col);
+	const OOGlyphAtlas *layoutText(const char *txt, FT_Face face, int startX, int startY, std::vector<OOGlyphQuad>& quads);
 	void calcTextDim(const char *txt, FT_Face face, TextDim& textDimm);
+	bool textBounds(const char *txt, FT_Face face, int startX, int startY, OORect& out);
 
 public:
 	OOScene2D();
 	~OOScene2D();
 
-	bool Init(int w, int h, int pixelDepth, size_t memSize, int numFrameBuffers);
+	bool Init(int w, int h, int pixelDepth, size_t memSize, int numFrameBuffers, int renderWidth = 0, int renderHeight = 0);
 
 	void SetActiveFrameBuffer(int index);
 	void SubmitFlip(int frameID);
@@ -201,16 +821,40 @@ public:
 	void FrameBufferSwap();
 	void FrameBufferClear();
 	void FrameBufferFill(Color color);
+	void SetDirtyTracking(bool enable);
+	void SetCommandBuffering(bool enable);
+	void SetCachedBackBuffer(bool enable);
+	void SetScaleFilter(OOScaleFilter filter);
+	void SetRenderWorkers(int count);
+	void SetPresentMode(OOPresentMode mode);
+	void SetFlipQueue(std::unique_ptr<OOFlipQueue> queue);
+	void SetFrameStats(bool enable);
+	void GetFrameStats(OOFrameStats& out);
+
+	void PushClip(int x, int y, int w, int h);
+	void PopClip();
 
 	void DrawPixel(int x, int y, Color color);
 	void DrawRectangle(int x, int y, int w, int h, Color color);
 	void DrawPNG(int x, int y, int index);
 	void DrawPNGPart(int x, int y, int left, int top, int width, int height, int index);
+	void DrawPNGBatch(const int *indices, const int *xs, const int *ys, size_t count);
+	void DrawPNGTransformed(int x, int y, int index, const OOSpriteTransform& transform);
+
+	void *AllocVideoMem(size_t size, size_t alignment);
+	void FreeVideoMem(void *ptr);
+	void GetVideoMemStats(OOVideoMemStats& out);
 
 	bool GetPixel(int x, int y, Color& out);
+	bool DumpFrameBuffer(int index, const std::string& fname);
 
 	int InitPNG(const std::string& fname);
 	int InitPNG(size_t bufSize, unsigned char *pngBuf);
+	int InitPNG(int w, int h, const Color *pixels);
+	int InitPNGAsync(const std::string& fname);
+	bool IsPNGReady(int index);
+	bool WaitPNG(int index);
+	void WaitPNGs();
 	void FreePNG(int index);
 	void CalcSpriteDim(int sprite, SpriteDim& out);
 
@@ -219,11 +863,13 @@ public:
 	int InitFont(const std::string& fname, int fontSize);
 	int InitFont(size_t bufSize, unsigned char *fontBuf, int fontSize);
 	bool FreeFont(int index);
+	void SetGlyphCacheSize(size_t bytes);
 	void DrawText(const std::string& txt, int font, int startX, int startY, Color col);
 	void CalcTextDim(const std::string& txt, int font, TextDim& textDimm);
 	void DrawTextContainer(const std::string& txt, int font, int startX, int startY, int maxW, int maxH);
 };
 
+#ifndef OOTOOLKIT_HEADLESS
 struct OOSampleData {
 	size_t sampleOffset;
 	size_t sampleCount;
@@ -242,6 +888,7 @@ struct OOAudioThreadData {
 class OOAudio {
 	int32_t audioHandle;
 	std::vector<OOSampleData> audioSamples;
+	OOAssetCache soundAssets;
 
 	std::mutex audioThreadMutex;
 	std::vector<std::thread> audioThreads; // instances
@@ -278,12 +925,17 @@ public:
 	bool IsPlaying(int index);
 	int PlaySound(int index, bool loop);
 };
+#endif
 
 class OOToolkit {
 private:
+#ifndef OOTOOLKIT_HEADLESS
 	std::unique_ptr<OOAudio> Audio;
+#endif
 	std::unique_ptr<OOScene2D> Scene2D;
+#ifndef OOTOOLKIT_HEADLESS
 	std::unique_ptr<OOController> Controller;
+#endif
 	std::unique_ptr<OOTcpClient> TcpClient;
 
 public:
@@ -291,9 +943,13 @@ public:
 	OOToolkit();
 	~OOToolkit();
 
+#ifndef OOTOOLKIT_HEADLESS
 	OOAudio *GetAudio();
+#endif
 	OOScene2D *GetScene2D();
+#ifndef OOTOOLKIT_HEADLESS
 	OOController *GetController();
+#endif
 	OOTcpClient *GetTcpClient();
 };
 
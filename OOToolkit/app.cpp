@@ -36,8 +36,8 @@ void Application::Load() {
 	// init sprites
 	DEBUGLOG << "-> Sprites!";
 
-	// cat.
-	this->sprites.push_back(this->kit->GetScene2D()->InitPNG("/app0/assets/image.png"));
+	// cat, decoded in the background while the rest loads. It's drawn once it's ready.
+	this->sprites.push_back(this->kit->GetScene2D()->InitPNGAsync("/app0/assets/image.png"));
 
 	// init sounds
 	DEBUGLOG << "-> Sounds!";
@@ -83,9 +83,12 @@ bool Application::Frame() {
 		// x and y position for the text.
 		int x = 128, y = 64;
 
-		// get sprite w/h
-		SpriteDim sd;
-		this->kit->GetScene2D()->CalcSpriteDim(catsprite, sd);
+		// get sprite w/h, it's only known once the cat is decoded.
+		bool catReady = this->kit->GetScene2D()->IsPNGReady(catsprite);
+		SpriteDim sd = { };
+		if (catReady) {
+			this->kit->GetScene2D()->CalcSpriteDim(catsprite, sd);
+		}
 
 		// reset our frame counter.
 		if (counter > FRAME_WIDTH) {
@@ -113,7 +116,9 @@ bool Application::Frame() {
 
 		
 		// loop the cat sprite.
-		this->kit->GetScene2D()->DrawPNG(counter, MIDDLE_Y - sd.h / 2, catsprite);
+		if (catReady) {
+			this->kit->GetScene2D()->DrawPNG(counter, MIDDLE_Y - sd.h / 2, catsprite);
+		}
 
 		// draw text.
 		this->kit->GetScene2D()->DrawText(dr.str(), myfont, x, y, this->drawCol);
@@ -0,0 +1,50 @@
+// Bakes PNGs into sprite files (see OOSpriteFileHeader) that OOScene2D loads without decoding.
+// Each image is written next to itself, e.g. assets/image.png -> assets/image.oos.
+// Build with `make tools`, then: oobake assets/*.png
+
+#include "OOToolkit.h"
+
+#include <stdio.h>
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s image.png [image.png ...]\n", argv[0]);
+		return 1;
+	}
+
+	int failed = 0;
+	for (int i = 1; i < argc; i++) {
+		FILE *file = fopen(argv[i], "rb");
+		if (file == nullptr) {
+			fprintf(stderr, "%s: can't open\n", argv[i]);
+			failed++;
+			continue;
+		}
+
+		std::vector<unsigned char> data;
+		unsigned char chunk[64 * 1024];
+		size_t read;
+		while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+			data.insert(data.end(), chunk, chunk + read);
+		}
+
+		fclose(file);
+
+		// Decode from memory, loading by path would read an up to date bake back instead
+		OOPNG png(data.size(), data.data());
+		std::string out = OOPNG::BakedPath(argv[i]);
+
+		// Stamped with the image, so a bake that's older than it isn't used
+		if (!png.SaveBaked(out, argv[i])) {
+			fprintf(stderr, "%s: can't write %s\n", argv[i], out.c_str());
+			failed++;
+			continue;
+		}
+
+		SpriteDim dim;
+		png.GetInfo(dim);
+		printf("%s -> %s (%dx%d)\n", argv[i], out.c_str(), dim.w, dim.h);
+	}
+
+	return failed == 0 ? 0 : 1;
+}
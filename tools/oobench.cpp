@@ -0,0 +1,479 @@
+// Micro benchmarks of the OOScene2D primitives on the headless build, with a JSON baseline to catch regressions.
+// Build and run with `make bench`, or by hand:
+//   oobench [--save] [--threshold 0.1] [--font font.ttf] [--workers N] baseline.json [image.png ...]
+// --save writes the baseline, otherwise the run is checked against it and the exit code is 1 if anything regressed.
+// Images are decoded as PNG and, if there's one next to them, as QOI.
+
+#include "OOToolkit.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Flips as soon as it's asked to, so presenting is timed without waiting for a vblank.
+class OOInstantFlipQueue : public OOFlipQueue {
+	int64_t flipArg = -1;
+
+public:
+	bool Submit(int /*bufferIndex*/, int64_t arg) override {
+		this->flipArg = arg;
+		return true;
+	}
+
+	int64_t GetFlipArg() override {
+		return this->flipArg;
+	}
+
+	bool WaitFlip() override {
+		return true;
+	}
+
+	bool GetFlipTime(int64_t /*flipArg*/, std::chrono::steady_clock::time_point& /*time*/) override {
+		return false;
+	}
+};
+
+struct OOBenchResult {
+	std::string name;
+	double nsPerCall;
+	double mpixelsPerSec; // 0 if the primitive isn't measured in pixels.
+};
+
+class OOBench {
+	std::vector<OOBenchResult> results;
+	double threshold; // allowed slowdown against the baseline, 0.1 is 10%.
+	std::chrono::milliseconds minTime; // per primitive
+
+public:
+	OOBench() {
+		this->threshold = 0.1;
+		this->minTime = std::chrono::milliseconds(200);
+	}
+
+	void SetThreshold(double fraction) {
+		this->threshold = fraction;
+	}
+
+	template <class F> const OOBenchResult& Measure(const std::string& name, double pixelsPerCall, F fn);
+
+	void Report();
+	bool SaveBaseline(const std::string& fname);
+	bool CheckBaseline(const std::string& fname);
+};
+
+template <class F> const OOBenchResult& OOBench::Measure(const std::string& name, double pixelsPerCall, F fn) {
+	// Warm up the caches (and the glyph atlas) first
+	for (int i = 0; i < 8; i++) {
+		fn();
+	}
+
+	// Double the batch until enough time went by, so the clock is read rarely even for tiny primitives
+	uint64_t calls = 0;
+	uint64_t batch = 1;
+	auto start = std::chrono::steady_clock::now();
+	std::chrono::nanoseconds elapsed;
+
+	do {
+		for (uint64_t i = 0; i < batch; i++) {
+			fn();
+		}
+
+		calls += batch;
+		batch *= 2;
+		elapsed = std::chrono::steady_clock::now() - start;
+	} while (elapsed < this->minTime);
+
+	double ns = static_cast<double>(elapsed.count());
+	this->results.push_back({ name, ns / calls, pixelsPerCall > 0 ? (pixelsPerCall * calls * 1000.0) / ns : 0 });
+	return this->results.back();
+}
+
+void OOBench::Report() {
+	for (const OOBenchResult& result : this->results) {
+		if (result.mpixelsPerSec > 0) {
+			printf("%-36s %12.1f ns/call %10.1f Mpixels/s\n", result.name.c_str(), result.nsPerCall, result.mpixelsPerSec);
+		}
+		else {
+			printf("%-36s %12.1f ns/call\n", result.name.c_str(), result.nsPerCall);
+		}
+	}
+}
+
+bool OOBench::SaveBaseline(const std::string& fname) {
+	FILE *file = fopen(fname.c_str(), "w");
+	if (file == nullptr) {
+		fprintf(stderr, "%s: can't write: %s\n", fname.c_str(), strerror(errno));
+		return false;
+	}
+
+	fprintf(file, "{\n");
+	for (size_t i = 0; i < this->results.size(); i++) {
+		const OOBenchResult& result = this->results[i];
+		fprintf(file, "\t\"%s\": { \"ns_per_call\": %.3f, \"mpixels_per_s\": %.3f }%s\n", result.name.c_str(), result.nsPerCall, result.mpixelsPerSec, i + 1 < this->results.size() ? "," : "");
+	}
+	fprintf(file, "}\n");
+
+	fclose(file);
+	return true;
+}
+
+bool OOBench::CheckBaseline(const std::string& fname) {
+	FILE *file = fopen(fname.c_str(), "r");
+	if (file == nullptr) {
+		fprintf(stderr, "%s: can't read: %s, make one with --save\n", fname.c_str(), strerror(errno));
+		return false;
+	}
+
+	std::string json;
+	char buf[4096];
+	size_t len;
+	while ((len = fread(buf, 1, sizeof(buf), file)) > 0) {
+		json.append(buf, len);
+	}
+
+	fclose(file);
+
+	// Only what SaveBaseline writes has to be understood: "name": { "ns_per_call": N, ... }
+	std::unordered_map<std::string, double> baseline;
+	size_t pos = 0;
+	while ((pos = json.find('"', pos)) != std::string::npos) {
+		size_t end = json.find('"', pos + 1);
+		size_t open = json.find('{', end);
+		size_t close = json.find('}', open);
+		if (end == std::string::npos || open == std::string::npos || close == std::string::npos) {
+			break;
+		}
+
+		std::string body = json.substr(open, close - open);
+		size_t key = body.find("\"ns_per_call\":");
+		if (key != std::string::npos) {
+			baseline[json.substr(pos + 1, end - pos - 1)] = strtod(body.c_str() + key + 14, nullptr);
+		}
+
+		pos = close + 1;
+	}
+
+	bool ok = true;
+	for (const OOBenchResult& result : this->results) {
+		auto it = baseline.find(result.name);
+		if (it == baseline.end()) {
+			printf("%s: not in the baseline\n", result.name.c_str());
+			continue;
+		}
+
+		if (result.nsPerCall > it->second * (1.0 + this->threshold)) {
+			printf("%s regressed: %.1f ns/call, baseline %.1f ns/call\n", result.name.c_str(), result.nsPerCall, it->second);
+			ok = false;
+		}
+	}
+
+	return ok;
+}
+
+static bool readFile(const std::string& path, std::vector<unsigned char>& out) {
+	FILE *file = fopen(path.c_str(), "rb");
+	if (file == nullptr) {
+		return false;
+	}
+
+	unsigned char chunk[64 * 1024];
+	size_t read;
+	out.clear();
+	while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+		out.insert(out.end(), chunk, chunk + read);
+	}
+
+	fclose(file);
+	return true;
+}
+
+// Mostly opaque sprites with a half transparent border, like most UI art.
+static int makeSprite(OOScene2D& scene, int w, int h) {
+	std::vector<Color> pixels(static_cast<size_t>(w) * h);
+
+	for (int y = 0; y < h; y++) {
+		for (int x = 0; x < w; x++) {
+			bool border = x < 2 || y < 2 || x >= w - 2 || y >= h - 2;
+			pixels[(y * w) + x] = { static_cast<uint8_t>(x), static_cast<uint8_t>(y), 128, static_cast<uint8_t>(border ? 128 : 255) };
+		}
+	}
+
+	return scene.InitPNG(w, h, pixels.data());
+}
+
+// The primitives, in immediate mode on the active frame buffer.
+static void benchPrimitives(OOBench& bench, const std::string& fontPath) {
+	const int w = 1920;
+	const int h = 1080;
+	Color red = { 255, 0, 0, 255 };
+	Color white = COLOR_WHITE;
+
+	OOScene2D scene;
+	OOScene2D *s = &scene;
+	if (!scene.Init(w, h, 4, 64 << 20, 2)) {
+		fprintf(stderr, "can't init the scene\n");
+		exit(1);
+	}
+
+	bench.Measure("FrameBufferFill", static_cast<double>(w) * h, [s, white] { s->FrameBufferFill(white); });
+
+	const int rectSizes[] = { 8, 64, 256 };
+	for (int size : rectSizes) {
+		bench.Measure("DrawRectangle " + std::to_string(size), size * size, [s, size, red] { s->DrawRectangle(16, 16, size, size, red); });
+	}
+
+	bench.Measure("DrawRectangle full", static_cast<double>(w) * h, [s, red] { s->DrawRectangle(0, 0, w, h, red); });
+
+	const int spriteSizes[] = { 16, 64, 256, -1 };
+	for (int size : spriteSizes) {
+		int sw = size < 0 ? w : size;
+		int sh = size < 0 ? h : size;
+		int sprite = makeSprite(scene, sw, sh);
+		std::string name = size < 0 ? "DrawPNG full" : "DrawPNG " + std::to_string(size);
+		bench.Measure(name, static_cast<double>(sw) * sh, [s, sprite] { s->DrawPNG(0, 0, sprite); });
+
+		// The transformed blitter's paths: mirrored, scaled by a whole number, and rotated
+		if (size == 64) {
+			OOSpriteTransform flip;
+			flip.flipX = true;
+			flip.originX = size / 2;
+			OOSpriteTransform scale2;
+			scale2.scaleX = scale2.scaleY = 2.0f;
+			OOSpriteTransform scale3; // 1/3 isn't exact in 16.16, the repeat comes from the scale itself
+			scale3.scaleX = scale3.scaleY = 3.0f;
+			OOSpriteTransform rotate;
+			rotate.rotation = 0.5f;
+			rotate.originX = rotate.originY = size / 2;
+
+			bench.Measure("DrawPNGTransformed 64 flip", size * size, [s, sprite, flip] { s->DrawPNGTransformed(64, 64, sprite, flip); });
+			bench.Measure("DrawPNGTransformed 64 x2", 4.0 * size * size, [s, sprite, scale2] { s->DrawPNGTransformed(0, 0, sprite, scale2); });
+			bench.Measure("DrawPNGTransformed 64 x3", 9.0 * size * size, [s, sprite, scale3] { s->DrawPNGTransformed(0, 0, sprite, scale3); });
+			bench.Measure("DrawPNGTransformed 64 rotate", 0, [s, sprite, rotate] { s->DrawPNGTransformed(64, 64, sprite, rotate); });
+		}
+
+		scene.FreePNG(sprite);
+	}
+
+	// A thousand 16px particles, one call each against a single batch
+	{
+		int particle = makeSprite(scene, 16, 16);
+		std::vector<int> indices(1000, particle);
+		std::vector<int> xs(1000);
+		std::vector<int> ys(1000);
+
+		for (int i = 0; i < 1000; i++) {
+			xs[i] = (i * 37) % w;
+			ys[i] = (i * 101) % h;
+		}
+
+		bench.Measure("DrawPNG 1000x16", 1000.0 * 16 * 16, [s, &indices, &xs, &ys] {
+			for (size_t i = 0; i < indices.size(); i++) {
+				s->DrawPNG(xs[i], ys[i], indices[i]);
+			}
+		});
+		bench.Measure("DrawPNGBatch 1000x16", 1000.0 * 16 * 16, [s, &indices, &xs, &ys] { s->DrawPNGBatch(indices.data(), xs.data(), ys.data(), indices.size()); });
+		scene.FreePNG(particle);
+	}
+
+	if (!fontPath.empty()) {
+		int font = scene.InitFont(fontPath, 24);
+		std::string shortText = "FPS: 60";
+		std::string longText;
+		for (int line = 0; line < 8; line++) {
+			longText += "The quick brown fox jumps over the lazy dog, 0123456789 times.\n";
+		}
+
+		bench.Measure("DrawText short", 0, [s, font, &shortText, white] { s->DrawText(shortText, font, 16, 64, white); });
+		bench.Measure("DrawText long", 0, [s, font, &longText, white] { s->DrawText(longText, font, 16, 64, white); });
+		scene.FreeFont(font);
+	}
+
+	Color out;
+	bench.Measure("GetPixel", 0, [s, &out] { s->GetPixel(100, 100, out); });
+}
+
+// Filling a 1920x1080 frame buffer (plain memory on the host) pixel by pixel, against the span fills it takes now.
+// The fill streams past the cache once it's FILL_STREAM_THRESHOLD pixels, a row at a time stays cached.
+static void benchFills(OOBench& bench) {
+	const int w = 1920;
+	const int h = 1080;
+	Color blue = { 0, 0, 255, 255 };
+
+	OOScene2D scene;
+	OOScene2D *s = &scene;
+	if (!scene.Init(w, h, 4, 64 << 20, 2)) {
+		fprintf(stderr, "can't init the scene\n");
+		exit(1);
+	}
+
+	// Only the fills themselves are compared
+	scene.SetDirtyTracking(false);
+
+	double pixelLoop = bench.Measure("Fill 1080p DrawPixel", static_cast<double>(w) * h, [s, blue] {
+		for (int y = 0; y < h; y++) {
+			for (int x = 0; x < w; x++) {
+				s->DrawPixel(x, y, blue);
+			}
+		}
+	}).nsPerCall;
+
+	double streamed = bench.Measure("Fill 1080p span streaming", static_cast<double>(w) * h, [s, blue] { s->DrawRectangle(0, 0, w, h, blue); }).nsPerCall;
+
+	double cached = bench.Measure("Fill 1080p span cached", static_cast<double>(w) * h, [s, blue] {
+		for (int y = 0; y < h; y++) {
+			s->DrawRectangle(0, y, w, 1, blue);
+		}
+	}).nsPerCall;
+
+	printf("Span fills against DrawPixel: %.1fx streaming, %.1fx cached\n", pixelLoop / streamed, pixelLoop / cached);
+}
+
+// Fill-bound frames in command buffer mode, rasterized in tiles by 1 to maxWorkers threads.
+// Commit waits for the previous frame's render, so a frame takes as long as rasterizing it.
+static void benchTiles(OOBench& bench, int maxWorkers) {
+	const int w = 1920;
+	const int h = 1080;
+	const int layers = 8;
+
+	OOScene2D scene;
+	OOScene2D *s = &scene;
+	if (!scene.Init(w, h, 4, 64 << 20, 2)) {
+		fprintf(stderr, "can't init the scene\n");
+		exit(1);
+	}
+
+	scene.SetFlipQueue(std::unique_ptr<OOFlipQueue>(new OOInstantFlipQueue()));
+	scene.SetCommandBuffering(true);
+
+	// Full screen half transparent sprites, every pixel of every layer is blended
+	int sprite = makeSprite(scene, w, h);
+	std::vector<int> indices(layers, sprite);
+	std::vector<int> xs(layers, 0);
+	std::vector<int> ys(layers, 0);
+
+	double single = 0;
+	for (int workers = 1; workers <= maxWorkers; workers++) {
+		scene.SetRenderWorkers(workers);
+
+		double ns = bench.Measure("Tiled frame " + std::to_string(workers) + " workers", static_cast<double>(w) * h * layers, [s, &indices, &xs, &ys] {
+			s->DrawPNGBatch(indices.data(), xs.data(), ys.data(), indices.size());
+			s->Commit();
+		}).nsPerCall;
+
+		if (workers == 1) {
+			single = ns;
+		}
+
+		printf("Tiled rendering, %d workers: %.2fx\n", workers, single / ns);
+	}
+
+	scene.SetCommandBuffering(false);
+	scene.FreePNG(sprite);
+}
+
+// Presenting a frame drawn at a lower internal resolution: a full redraw, scaled up to 1920x1080.
+static void benchUpscale(OOBench& bench) {
+	const int renderSizes[][2] = { { 960, 540 }, { 1280, 720 } };
+	const OOScaleFilter filters[] = { SCALE_NEAREST, SCALE_BILINEAR };
+	Color red = { 255, 0, 0, 255 };
+
+	for (const auto& size : renderSizes) {
+		for (OOScaleFilter filter : filters) {
+			OOScene2D scene;
+			OOScene2D *s = &scene;
+			if (!scene.Init(1920, 1080, 4, 64 << 20, 2, size[0], size[1])) {
+				fprintf(stderr, "can't init the scene\n");
+				exit(1);
+			}
+
+			scene.SetFlipQueue(std::unique_ptr<OOFlipQueue>(new OOInstantFlipQueue()));
+			scene.SetScaleFilter(filter);
+
+			std::string name = "Present " + std::to_string(size[0]) + "x" + std::to_string(size[1]) + (filter == SCALE_NEAREST ? " nearest" : " bilinear");
+			int w = size[0];
+			int h = size[1];
+			bench.Measure(name, 1920.0 * 1080, [s, w, h, red] {
+				s->DrawRectangle(0, 0, w, h, red);
+				s->Commit();
+			});
+		}
+	}
+}
+
+// Decoding the same image as PNG and, if there's one next to it, as QOI. Files are read up front, only decoding is timed.
+static void benchLoads(OOBench& bench, const std::vector<std::string>& images) {
+	for (const std::string& path : images) {
+		size_t dot = path.find_last_of('.');
+		size_t slash = path.find_last_of('/');
+		std::string name = path.substr(slash == std::string::npos ? 0 : slash + 1);
+		std::string qoiPath = (dot == std::string::npos || (slash != std::string::npos && dot < slash) ? path : path.substr(0, dot)) + ".qoi";
+
+		std::vector<unsigned char> png;
+		if (!readFile(path, png)) {
+			fprintf(stderr, "%s: can't read\n", path.c_str());
+			continue;
+		}
+
+		SpriteDim dim;
+		OOPNG(png.size(), png.data()).GetInfo(dim);
+		double pixels = static_cast<double>(dim.w) * dim.h;
+
+		bench.Measure("Load PNG " + name, pixels, [&png] { OOPNG(png.size(), png.data()); });
+
+		std::vector<unsigned char> qoi;
+		if (!readFile(qoiPath, qoi)) {
+			printf("%s: no %s, skipping the QOI load\n", path.c_str(), qoiPath.c_str());
+			continue;
+		}
+
+		bench.Measure("Load QOI " + name, pixels, [&qoi] { OOPNG(qoi.size(), qoi.data()); });
+	}
+}
+
+int main(int argc, char **argv) {
+	OOBench bench;
+	bool save = false;
+	int maxWorkers = std::max(2, static_cast<int>(std::thread::hardware_concurrency()));
+	std::string fontPath;
+	std::string baseline;
+	std::vector<std::string> images;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--save") == 0) {
+			save = true;
+		}
+		else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+			bench.SetThreshold(atof(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+			maxWorkers = std::max(1, atoi(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--font") == 0 && i + 1 < argc) {
+			fontPath = argv[++i];
+		}
+		else if (baseline.empty()) {
+			baseline = argv[i];
+		}
+		else {
+			images.push_back(argv[i]);
+		}
+	}
+
+	if (baseline.empty()) {
+		fprintf(stderr, "usage: %s [--save] [--threshold 0.1] [--font font.ttf] [--workers N] baseline.json [image.png ...]\n", argv[0]);
+		return 1;
+	}
+
+	benchPrimitives(bench, fontPath);
+	benchFills(bench);
+	benchTiles(bench, maxWorkers);
+	benchUpscale(bench);
+	benchLoads(bench, images);
+	bench.Report();
+
+	if (save) {
+		return bench.SaveBaseline(baseline) ? 0 : 1;
+	}
+
+	return bench.CheckBaseline(baseline) ? 0 : 1;
+}
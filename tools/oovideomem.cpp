@@ -0,0 +1,181 @@
+// Checks the video memory allocator on the headless build: alignment, padding, coalescing and the stats it reports.
+// Build and run with `make check`, or by hand: oovideomem
+// The exit code is 1 if any check failed.
+
+#include "OOToolkit.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <random>
+
+static int failures = 0;
+
+static void expect(bool ok, const char *what) {
+	if (!ok) {
+		fprintf(stderr, "FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+static bool aligned(void *ptr, size_t alignment) {
+	return reinterpret_cast<uintptr_t>(ptr) % alignment == 0;
+}
+
+// Everything handed out has been given back, the region has to look like it did before.
+static void expectRestored(OOScene2D& scene, const OOVideoMemStats& before, const char *what) {
+	OOVideoMemStats after;
+	scene.GetVideoMemStats(after);
+
+	if (after.used != before.used || after.allocations != before.allocations || after.freeBlocks != before.freeBlocks || after.largestFree != before.largestFree) {
+		fprintf(stderr, "FAIL: %s: used %zu/%zu, allocations %zu/%zu, free blocks %zu/%zu, largest free %zu/%zu\n", what,
+			after.used, before.used, after.allocations, before.allocations, after.freeBlocks, before.freeBlocks, after.largestFree, before.largestFree);
+		failures++;
+	}
+}
+
+// Sizes are rounded up to the granule, alignment comes from padding that stays free.
+static void checkAlignment(OOScene2D& scene, const OOVideoMemStats& before) {
+	OOVideoMemStats stats;
+
+	void *a = scene.AllocVideoMem(100, 1);
+	scene.GetVideoMemStats(stats);
+	expect(a != nullptr && aligned(a, 64), "small allocations are granule aligned");
+	expect(stats.used == before.used + 128, "small allocations are rounded up to the granule");
+	expect(stats.allocations == before.allocations + 1, "allocations are counted");
+
+	void *b = scene.AllocVideoMem(64, 0x10000);
+	OOVideoMemStats padded;
+	scene.GetVideoMemStats(padded);
+	expect(b != nullptr && aligned(b, 0x10000), "aligned allocations are aligned");
+	expect(padded.used == stats.used + 64, "alignment padding isn't counted as used");
+	expect(padded.freeBlocks == stats.freeBlocks + 1, "alignment padding stays free");
+
+	// The padding is reused by the next allocation that fits
+	void *c = scene.AllocVideoMem(1024, 64);
+	expect(c != nullptr && c > a && c < b, "allocations go into the alignment padding");
+
+	scene.FreeVideoMem(b);
+	scene.FreeVideoMem(a);
+	scene.FreeVideoMem(c);
+	expectRestored(scene, before, "freeing aligned allocations");
+}
+
+// Free neighbours merge, whichever order they're freed in.
+static void checkCoalescing(OOScene2D& scene, const OOVideoMemStats& before) {
+	const int count = 8;
+	void *blocks[count];
+	for (int i = 0; i < count; i++) {
+		blocks[i] = scene.AllocVideoMem(4096, 64);
+		expect(blocks[i] != nullptr, "allocating neighbours");
+	}
+
+	for (int i = 1; i < count; i++) {
+		expect(blocks[i] == reinterpret_cast<char *>(blocks[i - 1]) + 4096, "neighbours are handed out back to back");
+	}
+
+	OOVideoMemStats full;
+	scene.GetVideoMemStats(full);
+
+	// Every other one leaves holes that can't merge
+	for (int i = 0; i < count; i += 2) {
+		scene.FreeVideoMem(blocks[i]);
+	}
+
+	OOVideoMemStats holes;
+	scene.GetVideoMemStats(holes);
+	expect(holes.freeBlocks == full.freeBlocks + count / 2, "holes between used blocks don't merge");
+	expect(holes.used == full.used - count / 2 * 4096, "freed holes aren't used");
+
+	// The rest close them up, back to one block
+	for (int i = count - 1; i > 0; i -= 2) {
+		scene.FreeVideoMem(blocks[i]);
+	}
+
+	expectRestored(scene, before, "freeing neighbours");
+}
+
+// largestFree is a promise: asking for exactly that much works.
+static void checkLargestFree(OOScene2D& scene, const OOVideoMemStats& before) {
+	expect(before.largestFree > 0, "there's free memory after Init");
+
+	void *all = scene.AllocVideoMem(before.largestFree, 1);
+	expect(all != nullptr, "allocating largestFree succeeds");
+	scene.FreeVideoMem(all);
+
+	expect(scene.AllocVideoMem(before.total + 64, 1) == nullptr, "allocating more than the region fails");
+	expectRestored(scene, before, "allocating largestFree");
+}
+
+// Random sizes and alignments, every allocation filled with its own byte so overlaps show up.
+static void checkRandom(OOScene2D& scene, const OOVideoMemStats& before) {
+	struct Allocation {
+		unsigned char *ptr;
+		size_t size;
+		unsigned char fill;
+	};
+
+	std::mt19937 rng(7);
+	std::vector<Allocation> live;
+
+	for (int i = 0; i < 20000; i++) {
+		if (live.empty() || rng() % 3 != 0) {
+			size_t size = 1 + rng() % (rng() % 8 == 0 ? 256 * 1024 : 4096);
+			size_t alignment = static_cast<size_t>(1) << (rng() % 17);
+			unsigned char *ptr = reinterpret_cast<unsigned char *>(scene.AllocVideoMem(size, alignment));
+			if (ptr == nullptr) {
+				continue;
+			}
+
+			expect(aligned(ptr, alignment), "random allocations are aligned");
+			unsigned char fill = static_cast<unsigned char>(rng());
+			memset(ptr, fill, size);
+			live.push_back({ ptr, size, fill });
+		}
+		else {
+			size_t index = rng() % live.size();
+			Allocation allocation = live[index];
+			live[index] = live.back();
+			live.pop_back();
+
+			bool intact = true;
+			for (size_t b = 0; b < allocation.size; b++) {
+				intact = intact && allocation.ptr[b] == allocation.fill;
+			}
+
+			expect(intact, "random allocations don't overlap");
+			scene.FreeVideoMem(allocation.ptr);
+		}
+	}
+
+	for (const Allocation& allocation : live) {
+		scene.FreeVideoMem(allocation.ptr);
+	}
+
+	expectRestored(scene, before, "freeing random allocations");
+}
+
+int main() {
+	OOScene2D scene;
+	if (!scene.Init(640, 360, 4, 64 << 20, 2)) {
+		fprintf(stderr, "can't init the scene\n");
+		return 1;
+	}
+
+	// Whatever Init took for the frame buffers stays put
+	OOVideoMemStats before;
+	scene.GetVideoMemStats(before);
+
+	checkAlignment(scene, before);
+	checkCoalescing(scene, before);
+	checkLargestFree(scene, before);
+	checkRandom(scene, before);
+
+	if (failures > 0) {
+		fprintf(stderr, "%d checks failed\n", failures);
+		return 1;
+	}
+
+	printf("video memory allocator ok\n");
+	return 0;
+}